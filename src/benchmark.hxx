@@ -0,0 +1,568 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <omp.h>
+#include "math.hxx"
+#include "rng.hxx"
+#include "ray.hxx"
+#include "geometry.hxx"
+#include "bvh.hxx"
+#include "packed_geometry.hxx"
+#include "framebuffer.hxx"
+#include "splatbuffer.hxx"
+#include "utils.hxx"
+
+//////////////////////////////////////////////////////////////////////////
+// BVH scaling benchmark
+//
+// Random triangle soups of growing size, traced with the linear
+// GeometryList and with the BVH. Reports rays/sec for closest hit
+// and any hit (shadow) queries.
+
+namespace BvhBenchmark
+{
+  void CreateTriangleSoup(
+    Rng                            &aRng,
+    int                            aCount,
+    std::vector<AbstractGeometry*> &oGeometry)
+  {
+    // Keep the total triangle area roughly constant, so that ray
+    // coherence does not change wildly with the primitive count
+    const float size = 2.f / std::pow(float(aCount), 1.f / 3.f);
+
+    oGeometry.reserve(aCount);
+    for(int i=0; i<aCount; i++)
+    {
+      const Vec3f p0 = aRng.GetVec3f() * Vec3f(2.f) - Vec3f(1.f);
+      const Vec3f p1 = p0 + (aRng.GetVec3f() - Vec3f(0.5f)) * Vec3f(size);
+      const Vec3f p2 = p0 + (aRng.GetVec3f() - Vec3f(0.5f)) * Vec3f(size);
+      oGeometry.push_back(new Triangle(p0, p1, p2, 0));
+    }
+  }
+
+  void CreateRays(
+    Rng              &aRng,
+    int              aCount,
+    std::vector<Ray> &oRays)
+  {
+    oRays.resize(aCount);
+    for(int i=0; i<aCount; i++)
+    {
+      oRays[i].org  = aRng.GetVec3f() * Vec3f(2.f) - Vec3f(1.f);
+      oRays[i].dir  = SampleUniformSphereW(aRng.GetVec2f(), NULL);
+      oRays[i].tmin = 0;
+    }
+  }
+
+  // Returns rays per second, oHits is the number of rays that hit something
+  double TraceRays(
+    const AbstractGeometry &aGeometry,
+    const std::vector<Ray> &aRays,
+    bool                   aAnyHit,
+    int                    *oHits)
+  {
+    int hits = 0;
+    const double startT = omp_get_wtime();
+
+    for(int i=0; i<(int)aRays.size(); i++)
+    {
+      Isect isect;
+      const bool hit = aAnyHit ?
+        aGeometry.IntersectP(aRays[i], isect) :
+        aGeometry.Intersect(aRays[i], isect);
+
+      if(hit)
+        hits++;
+    }
+
+    const double time = omp_get_wtime() - startT;
+
+    if(oHits)
+      *oHits = hits;
+
+    return aRays.size() / std::max(time, 1e-9);
+  }
+}
+
+void BenchmarkBvhScaling()
+{
+  using namespace BvhBenchmark;
+
+  const int primCounts[] = { 100, 1000, 10000, 100000, 1000000 };
+  const int numRays      = 200000;
+
+  // The linear list is O(n) per ray, limit the amount of work spent on it
+  const double maxListTests = 5e7;
+
+  printf("BVH scaling benchmark, single thread, %d rays\n\n", numRays);
+  printf("%10s %10s %8s | %12s %12s | %12s %12s | %9s %12s %8s\n",
+    "prims", "nodes", "build s",
+    "list close", "list any", "bvh close", "bvh any",
+    "list rays", "bvh subset", "speedup");
+
+  for(int c=0; c<int(sizeof(primCounts) / sizeof(primCounts[0])); c++)
+  {
+    const int count = primCounts[c];
+    Rng rng(1234 + c);
+
+    GeometryList list;
+    CreateTriangleSoup(rng, count, list.mGeometry);
+
+    std::vector<Ray> rays;
+    CreateRays(rng, numRays, rays);
+
+    // Linear list first, afterwards its primitives are moved into the BVH
+    const int listRays = int(std::min<double>(numRays, maxListTests / count));
+    std::vector<Ray> listSubset(rays.begin(), rays.begin() + listRays);
+
+    int listHits = 0;
+    const double listClose = TraceRays(list, listSubset, false, &listHits);
+    const double listAny   = TraceRays(list, listSubset, true,  NULL);
+
+    BVH bvh;
+    const double buildStartT = omp_get_wtime();
+    bvh.Build(list.mGeometry);
+    const double buildTime = omp_get_wtime() - buildStartT;
+
+    int bvhHits = 0;
+    const double bvhClose = TraceRays(bvh, listSubset, false, &bvhHits);
+    const double bvhAny   = TraceRays(bvh, rays,       true,  NULL);
+    const double bvhCloseAll = TraceRays(bvh, rays,    false, NULL);
+
+    printf("%10d %10d %8.3f | %12.0f %12.0f | %12.0f %12.0f | %9d %12.0f %7.1fx%s\n",
+      count, bvh.GetNodeCount(), buildTime,
+      listClose, listAny, bvhCloseAll, bvhAny,
+      listRays, bvhClose, bvhClose / listClose,
+      listHits != bvhHits ? "  MISMATCH" : "");
+  }
+
+  printf("\nAll close/any/subset columns are rays/sec. The list only traces the first\n");
+  printf("<list rays> rays, bvh subset traces the same ones for the speedup.\n");
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Packed geometry benchmark
+//
+// Intersects a cache resident set of primitives with every ray, once as
+// individual Triangle/Sphere objects, once through the scalar loop of the
+// packs and once through their SIMD kernels. Reports Mrays/s.
+
+namespace PackedBenchmark
+{
+  // Every ray is tested against all of aGeometry, returns Mrays/s
+  template<typename TGeometry, typename TIntersect>
+  double TraceAll(
+    const std::vector<TGeometry> &aGeometry,
+    const std::vector<Ray>       &aRays,
+    TIntersect                   aIntersect,
+    int                          *oHits)
+  {
+    int hits = 0;
+    const double startT = omp_get_wtime();
+
+    for(int r=0; r<(int)aRays.size(); r++)
+    {
+      Isect isect;
+      bool  hit = false;
+
+      for(int i=0; i<(int)aGeometry.size(); i++)
+        hit |= aIntersect(aGeometry[i], aRays[r], isect);
+
+      if(hit)
+        hits++;
+    }
+
+    const double time = omp_get_wtime() - startT;
+
+    if(oHits)
+      *oHits = hits;
+
+    return aRays.size() / std::max(time, 1e-9) * 1e-6;
+  }
+
+  struct VirtualIntersect
+  {
+    bool operator()(const AbstractGeometry *aGeom, const Ray &aRay, Isect &oIsect) const
+    { return aGeom->Intersect(aRay, oIsect); }
+  };
+
+  template<typename TPack>
+  struct ScalarIntersect
+  {
+    bool operator()(const TPack &aPack, const Ray &aRay, Isect &oIsect) const
+    { return aPack.IntersectScalar(aRay, oIsect); }
+  };
+
+  template<typename TPack>
+  struct DefaultIntersect
+  {
+    bool operator()(const TPack &aPack, const Ray &aRay, Isect &oIsect) const
+    { return aPack.Intersect(aRay, oIsect); }
+  };
+
+  template<typename TPack>
+  void Report(
+    const char                     *aName,
+    std::vector<AbstractGeometry*> &aObjects,
+    const std::vector<TPack>       &aPacks,
+    const std::vector<Ray>         &aRays)
+  {
+    int objectHits = 0, scalarHits = 0, simdHits = 0;
+    const double objectRate = TraceAll(aObjects, aRays, VirtualIntersect(), &objectHits);
+    const double scalarRate = TraceAll(aPacks, aRays, ScalarIntersect<TPack>(), &scalarHits);
+    const double simdRate   = TraceAll(aPacks, aRays, DefaultIntersect<TPack>(), &simdHits);
+
+    printf("%-10s %8d | %10.3f %10.3f %10.3f | %6.2fx%s\n",
+      aName, (int)aObjects.size(), objectRate, scalarRate, simdRate,
+      simdRate / scalarRate,
+      (objectHits != scalarHits || scalarHits != simdHits) ? "  MISMATCH" : "");
+  }
+}
+
+void BenchmarkPackedGeometry()
+{
+  using namespace PackedBenchmark;
+
+  const int numPrims = 1024;
+  const int numRays  = 20000;
+
+#if defined(PG3_SIMD_AVX)
+  const char *simdName = "AVX";
+#elif defined(PG3_SIMD_SSE)
+  const char *simdName = "SSE";
+#else
+  const char *simdName = "none (scalar)";
+#endif
+
+  printf("Packed geometry benchmark, single thread, %d rays, SIMD: %s, width %d\n\n",
+    numRays, simdName, int(PG3_PACK_WIDTH));
+  printf("%-10s %8s | %10s %10s %10s | %7s\n",
+    "primitive", "count", "objects", "scalar", "simd", "speedup");
+
+  Rng rng(1234);
+
+  std::vector<Ray> rays;
+  BvhBenchmark::CreateRays(rng, numRays, rays);
+
+  // Triangles
+  {
+    std::vector<AbstractGeometry*> objects;
+    BvhBenchmark::CreateTriangleSoup(rng, numPrims, objects);
+
+    std::vector<TrianglePack> packs;
+    for(int i=0; i<numPrims; i++)
+    {
+      if(packs.empty() || !packs.back().Add(*static_cast<Triangle*>(objects[i])))
+      {
+        packs.push_back(TrianglePack());
+        packs.back().Add(*static_cast<Triangle*>(objects[i]));
+      }
+    }
+
+    Report("triangles", objects, packs, rays);
+
+    for(int i=0; i<numPrims; i++)
+      delete objects[i];
+  }
+
+  // Spheres
+  {
+    std::vector<AbstractGeometry*> objects;
+    std::vector<SpherePack>        packs;
+
+    const float radius = 1.f / std::pow(float(numPrims), 1.f / 3.f);
+    for(int i=0; i<numPrims; i++)
+    {
+      Sphere *sphere = new Sphere(rng.GetVec3f() * Vec3f(2.f) - Vec3f(1.f),
+        radius * (0.2f + 0.8f * rng.GetFloat()), 0);
+      objects.push_back(sphere);
+
+      if(packs.empty() || !packs.back().Add(*sphere))
+      {
+        packs.push_back(SpherePack());
+        packs.back().Add(*sphere);
+      }
+    }
+
+    Report("spheres", objects, packs, rays);
+
+    for(int i=0; i<numPrims; i++)
+      delete objects[i];
+  }
+
+  // Whole BVH, plain leaves against packed leaves
+  {
+    const int bvhPrims = 100000;
+    const int bvhRays  = 200000;
+
+    std::vector<Ray> bvhRaySet;
+    BvhBenchmark::CreateRays(rng, bvhRays, bvhRaySet);
+
+    double rates[2];
+    for(int packed=0; packed<2; packed++)
+    {
+      Rng soupRng(4321);
+      std::vector<AbstractGeometry*> soup;
+      BvhBenchmark::CreateTriangleSoup(soupRng, bvhPrims, soup);
+
+      BVH bvh;
+      bvh.Build(soup, packed != 0);
+      rates[packed] = BvhBenchmark::TraceRays(bvh, bvhRaySet, false, NULL) * 1e-6;
+    }
+
+    printf("\nBVH over %d triangles: %.3f Mrays/s plain leaves, %.3f Mrays/s packed leaves (%.2fx)\n",
+      bvhPrims, rates[0], rates[1], rates[1] / rates[0]);
+  }
+
+  printf("\nColumns objects, scalar and simd are Mrays/s\n");
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Splatting benchmark
+//
+// Every thread adds random colors to random pixels, as a light tracer
+// does. Once with one Framebuffer per thread merged at the end (the
+// --no-splat-buffer path of render()), once through SplatLogs into one
+// shared SplatBuffer. Reports memory and Msplats/s including the merge.
+
+namespace SplatBenchmark
+{
+  struct Result
+  {
+    double mTime;
+    double mMergeTime;
+    size_t mMemory;
+    float  mLuminance;
+  };
+
+  Result PerThreadFramebuffers(
+    const Vec2f &aResolution,
+    int         aNumThreads,
+    int         aSplatsPerThread)
+  {
+    Result result;
+    std::vector<Framebuffer> framebuffers(aNumThreads);
+
+    const double startT = omp_get_wtime();
+
+#pragma omp parallel num_threads(aNumThreads)
+    {
+      const int threadId = omp_get_thread_num();
+      Framebuffer &framebuffer = framebuffers[threadId];
+      framebuffer.Setup(aResolution);
+
+      Rng rng(1234 + threadId);
+      for(int i=0; i<aSplatsPerThread; i++)
+      {
+        const Vec2f sample = rng.GetVec2f() * aResolution;
+        framebuffer.AddColor(sample, rng.GetVec3f());
+      }
+    }
+
+    const double mergeStartT = omp_get_wtime();
+
+    for(int i=1; i<aNumThreads; i++)
+      framebuffers[0].Add(framebuffers[i]);
+    framebuffers[0].Scale(1.f / aNumThreads);
+
+    const double endT = omp_get_wtime();
+
+    result.mTime      = endT - startT;
+    result.mMergeTime = endT - mergeStartT;
+    result.mMemory    = aNumThreads * size_t(aResolution.x * aResolution.y) * sizeof(Vec3f);
+    result.mLuminance = framebuffers[0].TotalLuminance();
+    return result;
+  }
+
+  Result SharedSplatBuffer(
+    const Vec2f &aResolution,
+    int         aNumThreads,
+    int         aSplatsPerThread)
+  {
+    Result result;
+    SplatBuffer splatBuffer;
+    size_t logMemory = 0;
+
+    const double startT = omp_get_wtime();
+    splatBuffer.Setup(aResolution);
+
+#pragma omp parallel num_threads(aNumThreads)
+    {
+      const int threadId = omp_get_thread_num();
+      SplatLog splatLog(splatBuffer);
+
+      Rng rng(1234 + threadId);
+      for(int i=0; i<aSplatsPerThread; i++)
+      {
+        const Vec2f sample = rng.GetVec2f() * aResolution;
+        splatLog.Add(sample, rng.GetVec3f());
+      }
+
+      splatLog.Flush();
+
+#pragma omp atomic
+      logMemory += splatLog.GetMemorySize();
+    }
+
+    const double mergeStartT = omp_get_wtime();
+
+    Framebuffer framebuffer;
+    framebuffer.Setup(aResolution);
+    splatBuffer.Resolve(framebuffer, 1.f / aNumThreads);
+
+    const double endT = omp_get_wtime();
+
+    result.mTime      = endT - startT;
+    result.mMergeTime = endT - mergeStartT;
+    result.mMemory    = splatBuffer.GetMemorySize() + logMemory;
+    result.mLuminance = framebuffer.TotalLuminance();
+    return result;
+  }
+}
+
+void BenchmarkSplatting()
+{
+  using namespace SplatBenchmark;
+
+  const Vec2f resolution(1024.f, 1024.f);
+  const int   threadCounts[]  = { 1, 2, 4, 8, 16 };
+  const int   splatsPerThread = 2000000;
+
+  printf("Splatting benchmark, %gx%g image, %d splats per thread, %d cores\n\n",
+    resolution.x, resolution.y, splatsPerThread, omp_get_num_procs());
+  printf("%8s | %10s %10s %10s | %10s %10s %10s\n",
+    "threads", "fb MB", "fb Ms/s", "fb merge", "splat MB", "splat Ms/s", "resolve");
+
+  for(int t=0; t<int(sizeof(threadCounts) / sizeof(threadCounts[0])); t++)
+  {
+    const int numThreads = threadCounts[t];
+    const double numSplats = double(numThreads) * splatsPerThread;
+
+    const Result fb    = PerThreadFramebuffers(resolution, numThreads, splatsPerThread);
+    const Result splat = SharedSplatBuffer(resolution, numThreads, splatsPerThread);
+
+    // Float sums in different order, only gross differences are errors
+    const bool mismatch =
+      std::abs(fb.mLuminance - splat.mLuminance) > 1e-3f * fb.mLuminance;
+
+    printf("%8d | %10.1f %10.2f %9.3fs | %10.1f %10.2f %9.3fs%s\n",
+      numThreads,
+      fb.mMemory / (1024.0 * 1024.0), numSplats / fb.mTime * 1e-6, fb.mMergeTime,
+      splat.mMemory / (1024.0 * 1024.0), numSplats / splat.mTime * 1e-6, splat.mMergeTime,
+      mismatch ? "  MISMATCH" : "");
+  }
+
+  printf("\nMs/s is million splats per second including setup and merge\n");
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Sampler benchmark
+//
+// Speed of GetFloat/GetVec2f of every sampler type, and the error of a
+// 2D integral with a known value (a quarter disk, pi/4) estimated per
+// "pixel" with few samples each, as renderers do.
+
+namespace SamplerBenchmark
+{
+  // Returns million numbers per second
+  double MeasureSpeed(SamplerType aType)
+  {
+    Rng rng(1234, aType);
+    const int numSamples = 1 << 16;
+    const int numDims    = 32;
+
+    float sum = 0;
+    const double startT = omp_get_wtime();
+
+    for(int i=0; i<numSamples; i++)
+    {
+      rng.StartSample(uint(i), 0);
+
+      for(int d=0; d<numDims; d++)
+      {
+        const Vec2f v = rng.GetVec2f();
+        sum += v.x + v.y + rng.GetFloat();
+      }
+    }
+
+    const double time = omp_get_wtime() - startT;
+
+    // Keeps the loop from being optimized away
+    if(sum < 0)
+      printf("%f", sum);
+
+    return 3.0 * numSamples * numDims / std::max(time, 1e-9) * 1e-6;
+  }
+
+  // RMS error of the per pixel estimates of pi/4, the integral uses the
+  // 2D sample of dimension aDimension, numbers before it are drawn too
+  double QuarterDiskError(
+    SamplerType aType,
+    int         aSamplesPerPixel,
+    int         aDimension)
+  {
+    Rng rng(1234, aType);
+    const int numPixels = 4096;
+    double errorSqr = 0;
+
+    for(int p=0; p<numPixels; p++)
+    {
+      double sum = 0;
+
+      for(int s=0; s<aSamplesPerPixel; s++)
+      {
+        rng.StartSample(uint(p), uint(s));
+
+        for(int d=0; d<aDimension; d++)
+          rng.GetVec2f();
+
+        const Vec2f v = rng.GetVec2f();
+        sum += (v.x * v.x + v.y * v.y < 1.f) ? 1.0 : 0.0;
+      }
+
+      errorSqr += Sqr(sum / aSamplesPerPixel - PI_F / 4.0);
+    }
+
+    return std::sqrt(errorSqr / numPixels);
+  }
+}
+
+void BenchmarkSamplers()
+{
+  using namespace SamplerBenchmark;
+
+  const int sampleCounts[] = { 4, 16, 64 };
+
+  printf("Sampler benchmark, single thread\n\n");
+  printf("%-8s | %12s | %28s\n", "sampler", "Mnumbers/s", "quarter disk RMS error, spp");
+  printf("%-8s | %12s | %8d %8d %8d (dim 0)\n", "", "",
+    sampleCounts[0], sampleCounts[1], sampleCounts[2]);
+
+  for(int t=0; t<kSamplerMax; t++)
+  {
+    const SamplerType type = SamplerType(t);
+
+    printf("%-8s | %12.1f |", GetSamplerName(type), MeasureSpeed(type));
+
+    for(int c=0; c<3; c++)
+      printf(" %8.5f", QuarterDiskError(type, sampleCounts[c], 0));
+
+    printf("\n");
+  }
+
+  printf("\nError of the same integral at dimension 5 (after 5 other 2D samples)\n");
+
+  for(int t=0; t<kSamplerMax; t++)
+  {
+    const SamplerType type = SamplerType(t);
+
+    printf("%-8s |              |", GetSamplerName(type));
+
+    for(int c=0; c<3; c++)
+      printf(" %8.5f", QuarterDiskError(type, sampleCounts[c], 5));
+
+    printf("\n");
+  }
+}
@@ -16,6 +16,10 @@ public:
   PathTracer(aScene, aSeed)
   {}
 
+  virtual bool SupportsTiles() const { return false; }
+
+  virtual bool SupportsSplatting() const { return true; }
+
   virtual void RunIteration(int aIteration)
   {
     const int resX = int(mScene.mCamera.mResolution.x);
@@ -25,9 +29,16 @@ public:
     {
         const int x = pixID % resX;
         const int y = pixID / resX;
+
+        mRng.StartSample(uint(pixID), uint(aIteration));
+
         const Vec2f sample = Vec2f(float(x), float(y)) + mRng.GetVec2f();
       for (int lightID = 0; lightID < mScene.GetLightCount(); lightID++)
       {
+        // Light path keys follow the pixel keys, so that they differ
+        mRng.StartSample(uint(resX * resY) +
+          uint(pixID) * uint(mScene.GetLightCount()) + uint(lightID), uint(aIteration));
+
         BiPath biPath(mScene, mRng);
         biPath.createLight(lightID);
         biPath.createLightPath();
@@ -71,15 +82,15 @@ public:
     }
 
     Isect isect; if (!this->mScene.Intersect(camRay, isect))
-      mFramebuffer.AddColor(rasterHit, capacity
-                                        * Inv(totalPdf)
-                                        * brdf
-                                        * cosCamToNormal
-                                        * (1.0f/cameraRay.LenSqr())
-                                        * 1.0f/Sqr(cosToCamera)
-                                        * 1.0f/cosToCamera
-                                        * 1.0f / Sqr(2.0f * tan(22.5f/360.0f * 2.0f * PI_F))
-                                        );
+      splat(rasterHit, capacity
+                           * Inv(totalPdf)
+                           * brdf
+                           * cosCamToNormal
+                           * (1.0f/cameraRay.LenSqr())
+                           * 1.0f/Sqr(cosToCamera)
+                           * 1.0f/cosToCamera
+                           * 1.0f / Sqr(2.0f * tan(22.5f/360.0f * 2.0f * PI_F))
+                           );
   }
 
   Vec3f CameraDir(Vec3f worldPt)
@@ -0,0 +1,660 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "math.hxx"
+#include "ray.hxx"
+#include "geometry.hxx"
+#include "packed_geometry.hxx"
+
+//////////////////////////////////////////////////////////////////////////
+// Axis aligned bounding box
+
+struct BBox
+{
+  BBox() :
+    mMin(INFTY_F),
+    mMax(-INFTY_F)
+  {}
+
+  void Grow(const Vec3f &aPoint)
+  {
+    for(int j=0; j<3; j++)
+    {
+      mMin.Get(j) = std::min(mMin.Get(j), aPoint.Get(j));
+      mMax.Get(j) = std::max(mMax.Get(j), aPoint.Get(j));
+    }
+  }
+
+  void Grow(const BBox &aOther)
+  {
+    for(int j=0; j<3; j++)
+    {
+      mMin.Get(j) = std::min(mMin.Get(j), aOther.mMin.Get(j));
+      mMax.Get(j) = std::max(mMax.Get(j), aOther.mMax.Get(j));
+    }
+  }
+
+  bool IsEmpty() const
+  {
+    return mMin.x > mMax.x || mMin.y > mMax.y || mMin.z > mMax.z;
+  }
+
+  Vec3f Centroid() const
+  {
+    return (mMin + mMax) * Vec3f(0.5f);
+  }
+
+  // Half of the surface area, the constant factor cancels out in SAH
+  float HalfArea() const
+  {
+    if(IsEmpty())
+      return 0.f;
+
+    const Vec3f d = mMax - mMin;
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+  }
+
+  Vec3f mMin;
+  Vec3f mMax;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Node of a flattened hierarchy
+//
+// Interior nodes have the left child stored right after them and the
+// right child at mOffset. Leaves store their primitive range. Plain data,
+// so node arrays can be written to and mapped from scene caches.
+
+struct BVHNode
+{
+  BBox mBox;
+  int  mOffset; //!< Right child (interior) or first primitive (leaf)
+  int  mCount;  //!< Number of primitives, 0 for interior nodes
+  int  mAxis;   //!< Split axis of interior nodes
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Binned SAH builder
+//
+// Builds nodes over primitive bounding boxes only, so it serves both the
+// BVH of AbstractGeometry objects and the BVH of indexed triangle meshes.
+// The cost model of packed leaves assumes TrianglePack sized leaves.
+
+class BVHBuilder
+{
+public:
+
+  explicit BVHBuilder(bool aPackLeaves) : mPackLeaves(aPackLeaves)
+  {}
+
+  // Fills oNodes, oOrder receives the primitive indices in leaf order,
+  // so that every leaf references a contiguous range of them
+  void Build(
+    const std::vector<BBox> &aBoxes,
+    std::vector<BVHNode>    &oNodes,
+    std::vector<int>        &oOrder)
+  {
+    const int count = (int)aBoxes.size();
+    std::vector<PrimInfo> prims(count);
+
+    for(int i=0; i<count; i++)
+    {
+      prims[i].mBox      = aBoxes[i];
+      prims[i].mCentroid = aBoxes[i].Centroid();
+      prims[i].mIndex    = i;
+    }
+
+    oNodes.clear();
+    oNodes.reserve(std::max(1, 2 * count));
+    oNodes.push_back(BVHNode());
+    buildNode(oNodes, 0, prims, 0, count, 0);
+
+    oOrder.resize(count);
+    for(int i=0; i<count; i++)
+      oOrder[i] = prims[i].mIndex;
+  }
+
+  enum { kStackSize = 64 };
+
+private:
+
+  struct PrimInfo
+  {
+    BBox  mBox;
+    Vec3f mCentroid;
+    int   mIndex;
+  };
+
+  struct Bin
+  {
+    Bin() : mCount(0) {}
+
+    BBox mBox;
+    int  mCount;
+  };
+
+  enum
+  {
+    kNumBins      = 16,
+    kMaxLeafSize  = 4
+  };
+
+  // Cost of one traversal step relative to one primitive intersection
+  static float traversalCost() { return 0.125f; }
+
+  // One pack test costs about two scalar tests, but covers kWidth primitives
+  float intersectionCost(int aCount) const
+  {
+    if(mPackLeaves)
+      return 2.f * float((aCount + TrianglePack::kWidth - 1) / TrianglePack::kWidth);
+
+    return float(aCount);
+  }
+
+  int maxLeafSize() const
+  {
+    return mPackLeaves ? int(TrianglePack::kWidth) : int(kMaxLeafSize);
+  }
+
+  void buildNode(
+    std::vector<BVHNode>  &aoNodes,
+    int                   aNodeIdx,
+    std::vector<PrimInfo> &aPrims,
+    int                   aBegin,
+    int                   aEnd,
+    int                   aDepth)
+  {
+    BBox box, centroidBox;
+
+    for(int i=aBegin; i<aEnd; i++)
+    {
+      box.Grow(aPrims[i].mBox);
+      centroidBox.Grow(aPrims[i].mCentroid);
+    }
+
+    aoNodes[aNodeIdx].mBox    = box;
+    aoNodes[aNodeIdx].mOffset = aBegin;
+    aoNodes[aNodeIdx].mCount  = aEnd - aBegin;
+    aoNodes[aNodeIdx].mAxis   = 0;
+
+    const int count = aEnd - aBegin;
+
+    // Traversal stack holds at most one entry per level
+    if(count <= 1 || aDepth >= kStackSize - 1)
+      return;
+
+    // Find the best binned SAH split over all three axes
+    const float leafCost = intersectionCost(count);
+    float bestCost  = INFTY_F;
+    int   bestAxis  = -1;
+    int   bestSplit = 0;
+
+    for(int axis=0; axis<3; axis++)
+    {
+      const float cMin   = centroidBox.mMin.Get(axis);
+      const float extent = centroidBox.mMax.Get(axis) - cMin;
+
+      if(extent <= 0.f)
+        continue;
+
+      const float binScale = kNumBins / extent;
+      Bin bins[kNumBins];
+
+      for(int i=aBegin; i<aEnd; i++)
+      {
+        const int b = std::min(kNumBins - 1,
+          int((aPrims[i].mCentroid.Get(axis) - cMin) * binScale));
+        bins[b].mCount++;
+        bins[b].mBox.Grow(aPrims[i].mBox);
+      }
+
+      // Sweep from the right to get the costs of all right sides
+      float rightArea [kNumBins];
+      int   rightCount[kNumBins];
+      BBox  accBox;
+      int   accCount = 0;
+
+      for(int b=kNumBins-1; b>0; b--)
+      {
+        accBox.Grow(bins[b].mBox);
+        accCount += bins[b].mCount;
+        rightArea [b] = accBox.HalfArea();
+        rightCount[b] = accCount;
+      }
+
+      accBox   = BBox();
+      accCount = 0;
+
+      for(int b=0; b<kNumBins-1; b++)
+      {
+        accBox.Grow(bins[b].mBox);
+        accCount += bins[b].mCount;
+
+        if(accCount == 0 || rightCount[b+1] == 0)
+          continue;
+
+        const float cost = accBox.HalfArea() * intersectionCost(accCount) +
+          rightArea[b+1] * intersectionCost(rightCount[b+1]);
+
+        if(cost < bestCost)
+        {
+          bestCost  = cost;
+          bestAxis  = axis;
+          bestSplit = b + 1;
+        }
+      }
+    }
+
+    const float boxArea = box.HalfArea();
+    if(boxArea > 0.f)
+      bestCost = traversalCost() + bestCost / boxArea;
+
+    // All centroids coincide, or splitting does not pay off
+    if(bestAxis < 0 || (count <= maxLeafSize() && bestCost >= leafCost))
+      return;
+
+    const float cMin     = centroidBox.mMin.Get(bestAxis);
+    const float binScale = kNumBins /
+      (centroidBox.mMax.Get(bestAxis) - cMin);
+
+    PrimInfo *mid = std::partition(&aPrims[0] + aBegin, &aPrims[0] + aEnd,
+      BinPredicate(bestAxis, bestSplit, cMin, binScale));
+    const int midIdx = int(mid - &aPrims[0]);
+
+    // Left child goes right after this node, right child after the whole left subtree
+    const int leftIdx = (int)aoNodes.size();
+    aoNodes.push_back(BVHNode());
+    buildNode(aoNodes, leftIdx, aPrims, aBegin, midIdx, aDepth + 1);
+
+    const int rightIdx = (int)aoNodes.size();
+    aoNodes.push_back(BVHNode());
+    buildNode(aoNodes, rightIdx, aPrims, midIdx, aEnd, aDepth + 1);
+
+    aoNodes[aNodeIdx].mOffset = rightIdx;
+    aoNodes[aNodeIdx].mCount  = 0;
+    aoNodes[aNodeIdx].mAxis   = bestAxis;
+  }
+
+  struct BinPredicate
+  {
+    BinPredicate(int aAxis, int aSplit, float aMin, float aScale) :
+      mAxis(aAxis), mSplit(aSplit), mMin(aMin), mScale(aScale)
+    {}
+
+    bool operator()(const PrimInfo &aPrim) const
+    {
+      const int b = std::min(int(kNumBins) - 1,
+        int((aPrim.mCentroid.Get(mAxis) - mMin) * mScale));
+      return b < mSplit;
+    }
+
+    int   mAxis;
+    int   mSplit;
+    float mMin;
+    float mScale;
+  };
+
+  bool mPackLeaves;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Traversal of flattened nodes
+//
+// aLeaf tests the primitives of one leaf, it provides
+//   bool Intersect (int aOffset, int aCount, const Ray&, Isect&) const
+//   bool IntersectP(int aOffset, int aCount, const Ray&, Isect&) const
+
+namespace BVHTraversal
+{
+  inline Vec3f InvertDir(const Vec3f &aDir)
+  {
+    // Avoid NaNs from 0 * inf in the slab test
+    Vec3f res;
+    for(int j=0; j<3; j++)
+    {
+      const float d = aDir.Get(j);
+      res.Get(j) = 1.f / (std::abs(d) > 1e-20f ? d : (d < 0 ? -1e-20f : 1e-20f));
+    }
+    return res;
+  }
+
+  inline bool IntersectBox(
+    const BBox  &aBox,
+    const Ray   &aRay,
+    const Vec3f &aInvDir,
+    float       aMaxDist)
+  {
+    float tNear = aRay.tmin;
+    float tFar  = aMaxDist;
+
+    for(int j=0; j<3; j++)
+    {
+      float t0 = (aBox.mMin.Get(j) - aRay.org.Get(j)) * aInvDir.Get(j);
+      float t1 = (aBox.mMax.Get(j) - aRay.org.Get(j)) * aInvDir.Get(j);
+
+      if(t0 > t1) std::swap(t0, t1);
+
+      tNear = std::max(tNear, t0);
+      tFar  = std::min(tFar,  t1);
+    }
+
+    return tNear <= tFar;
+  }
+
+  // Ordered traversal, nearer child is visited first so that
+  // oResult.dist shrinks as early as possible
+  template<typename tLeaf>
+  bool Intersect(
+    const BVHNode *aNodes,
+    const Ray     &aRay,
+    Isect         &oResult,
+    const tLeaf   &aLeaf)
+  {
+    const Vec3f invDir = InvertDir(aRay.dir);
+    const int dirNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+    int stack[BVHBuilder::kStackSize];
+    int stackSize = 0;
+    int nodeIdx   = 0;
+    bool anyIntersection = false;
+
+    for(;;)
+    {
+      const BVHNode &node = aNodes[nodeIdx];
+
+      if(IntersectBox(node.mBox, aRay, invDir, oResult.dist))
+      {
+        if(node.mCount > 0)
+        {
+          if(aLeaf.Intersect(node.mOffset, node.mCount, aRay, oResult))
+            anyIntersection = true;
+
+          if(stackSize == 0)
+            break;
+          nodeIdx = stack[--stackSize];
+        }
+        else if(dirNeg[node.mAxis])
+        {
+          stack[stackSize++] = nodeIdx + 1;
+          nodeIdx = node.mOffset;
+        }
+        else
+        {
+          stack[stackSize++] = node.mOffset;
+          nodeIdx = nodeIdx + 1;
+        }
+      }
+      else
+      {
+        if(stackSize == 0)
+          break;
+        nodeIdx = stack[--stackSize];
+      }
+    }
+
+    return anyIntersection;
+  }
+
+  // Any hit traversal for shadow rays, exits on the first found intersection
+  template<typename tLeaf>
+  bool IntersectP(
+    const BVHNode *aNodes,
+    const Ray     &aRay,
+    Isect         &oResult,
+    const tLeaf   &aLeaf)
+  {
+    const Vec3f invDir = InvertDir(aRay.dir);
+
+    int stack[BVHBuilder::kStackSize];
+    int stackSize = 0;
+    int nodeIdx   = 0;
+
+    for(;;)
+    {
+      const BVHNode &node = aNodes[nodeIdx];
+
+      if(IntersectBox(node.mBox, aRay, invDir, oResult.dist))
+      {
+        if(node.mCount > 0)
+        {
+          if(aLeaf.IntersectP(node.mOffset, node.mCount, aRay, oResult))
+            return true;
+
+          if(stackSize == 0)
+            break;
+          nodeIdx = stack[--stackSize];
+        }
+        else
+        {
+          stack[stackSize++] = node.mOffset;
+          nodeIdx = nodeIdx + 1;
+        }
+      }
+      else
+      {
+        if(stackSize == 0)
+          break;
+        nodeIdx = stack[--stackSize];
+      }
+    }
+
+    return false;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Bounding volume hierarchy
+//
+// Binned SAH build over arbitrary AbstractGeometry primitives, bounds are
+// taken from their GrowBBox. Takes ownership of the primitives, same as
+// GeometryList does. Triangles and spheres sharing a leaf are optionally
+// repacked into TrianglePack/SpherePack, which test them all at once.
+
+class BVH : public AbstractGeometry
+{
+public:
+
+  BVH() : mPackLeaves(false)
+  {}
+
+  virtual ~BVH()
+  {
+    for(int i=0; i<(int)mGeometry.size(); i++)
+      delete mGeometry[i];
+  }
+
+  // Builds the hierarchy, aGeometry is moved into the BVH (left empty)
+  void Build(
+    std::vector<AbstractGeometry*> &aGeometry,
+    bool                           aPackLeaves = true)
+  {
+    mPackLeaves = aPackLeaves;
+
+    for(int i=0; i<(int)mGeometry.size(); i++)
+      delete mGeometry[i];
+
+    mGeometry.clear();
+    mNodes.clear();
+
+    // No nodes at all, the empty root would be traversed as interior
+    if(aGeometry.empty())
+      return;
+
+    const int count = (int)aGeometry.size();
+    std::vector<BBox> boxes(count);
+
+    for(int i=0; i<count; i++)
+      aGeometry[i]->GrowBBox(boxes[i].mMin, boxes[i].mMax);
+
+    std::vector<int> order;
+    BVHBuilder(mPackLeaves).Build(boxes, mNodes, order);
+
+    // Reorder primitives so that every leaf references a contiguous range
+    mGeometry.resize(count);
+    for(int i=0; i<count; i++)
+      mGeometry[i] = aGeometry[order[i]];
+
+    aGeometry.clear();
+
+    if(mPackLeaves)
+      packLeaves();
+  }
+
+  virtual bool Intersect(
+    const Ray &aRay,
+    Isect     &oResult) const
+  {
+    if(mNodes.empty())
+      return false;
+
+    return BVHTraversal::Intersect(&mNodes[0], aRay, oResult, GeometryLeaf(mGeometry));
+  }
+
+  virtual bool IntersectP(
+    const Ray &aRay,
+    Isect     &oResult) const
+  {
+    if(mNodes.empty())
+      return false;
+
+    return BVHTraversal::IntersectP(&mNodes[0], aRay, oResult, GeometryLeaf(mGeometry));
+  }
+
+  virtual void GrowBBox(
+    Vec3f &aoBBoxMin,
+    Vec3f &aoBBoxMax)
+  {
+    if(mNodes.empty() || mNodes[0].mBox.IsEmpty())
+      return;
+
+    for(int j=0; j<3; j++)
+    {
+      aoBBoxMin.Get(j) = std::min(aoBBoxMin.Get(j), mNodes[0].mBox.mMin.Get(j));
+      aoBBoxMax.Get(j) = std::max(aoBBoxMax.Get(j), mNodes[0].mBox.mMax.Get(j));
+    }
+  }
+
+  int GetNodeCount() const
+  {
+    return (int)mNodes.size();
+  }
+
+  int GetPrimitiveCount() const
+  {
+    return (int)mGeometry.size();
+  }
+
+public:
+
+  std::vector<AbstractGeometry*> mGeometry;
+
+private:
+
+  // Leaf test of BVHTraversal, primitives are the geometry objects
+  struct GeometryLeaf
+  {
+    explicit GeometryLeaf(const std::vector<AbstractGeometry*> &aGeometry) :
+      mGeometry(aGeometry)
+    {}
+
+    bool Intersect(int aOffset, int aCount, const Ray &aRay, Isect &oResult) const
+    {
+      bool anyIntersection = false;
+
+      for(int i=aOffset; i<aOffset + aCount; i++)
+      {
+        if(mGeometry[i]->Intersect(aRay, oResult))
+          anyIntersection = true;
+      }
+
+      return anyIntersection;
+    }
+
+    bool IntersectP(int aOffset, int aCount, const Ray &aRay, Isect &oResult) const
+    {
+      for(int i=aOffset; i<aOffset + aCount; i++)
+      {
+        if(mGeometry[i]->IntersectP(aRay, oResult))
+          return true;
+      }
+
+      return false;
+    }
+
+    const std::vector<AbstractGeometry*> &mGeometry;
+  };
+
+  // Replaces triangles and spheres of each leaf by packs,
+  // a type is only packed when the leaf holds at least two of it.
+  // Spheres too large for the float math of SpherePack are kept.
+  void packLeaves()
+  {
+    std::vector<AbstractGeometry*> packed;
+    packed.reserve(mGeometry.size());
+
+    for(int n=0; n<(int)mNodes.size(); n++)
+    {
+      BVHNode &node = mNodes[n];
+
+      if(node.mCount == 0)
+        continue;
+
+      int numTriangles = 0, numSpheres = 0;
+      for(int i=node.mOffset; i<node.mOffset + node.mCount; i++)
+      {
+        const Sphere *sphere = dynamic_cast<Sphere*>(mGeometry[i]);
+
+        if(dynamic_cast<Triangle*>(mGeometry[i])) numTriangles++;
+        if(sphere && SpherePack::CanPack(*sphere)) numSpheres++;
+      }
+
+      const int    first        = (int)packed.size();
+      TrianglePack *trianglePack = NULL;
+      SpherePack   *spherePack   = NULL;
+
+      for(int i=node.mOffset; i<node.mOffset + node.mCount; i++)
+      {
+        Triangle *triangle = dynamic_cast<Triangle*>(mGeometry[i]);
+        Sphere   *sphere   = dynamic_cast<Sphere*>  (mGeometry[i]);
+
+        if(sphere && !SpherePack::CanPack(*sphere))
+          sphere = NULL;
+
+        if(triangle && numTriangles > 1)
+        {
+          if(trianglePack == NULL || !trianglePack->Add(*triangle))
+          {
+            trianglePack = new TrianglePack;
+            trianglePack->Add(*triangle);
+            packed.push_back(trianglePack);
+          }
+          delete triangle;
+        }
+        else if(sphere && numSpheres > 1)
+        {
+          if(spherePack == NULL || !spherePack->Add(*sphere))
+          {
+            spherePack = new SpherePack;
+            spherePack->Add(*sphere);
+            packed.push_back(spherePack);
+          }
+          delete sphere;
+        }
+        else
+          packed.push_back(mGeometry[i]);
+      }
+
+      node.mOffset = first;
+      node.mCount  = (int)packed.size() - first;
+    }
+
+    mGeometry.swap(packed);
+  }
+
+private:
+
+  std::vector<BVHNode> mNodes;
+  bool                 mPackLeaves;
+};
@@ -4,6 +4,7 @@
 #include <cmath>
 #include "math.hxx"
 #include "ray.hxx"
+#include "stats.hxx"
 
 class Camera
 {
@@ -82,6 +83,7 @@ public:
 
   Ray GenerateRay(const Vec2f &aRasterXY) const
   {
+    STATS_COUNT(kStatPrimaryRays);
     const Vec3f worldRaster = RasterToWorld(aRasterXY);
 
     Ray res;
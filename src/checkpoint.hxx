@@ -0,0 +1,298 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "math.hxx"
+#include "framebuffer.hxx"
+
+//////////////////////////////////////////////////////////////////////////
+// Checkpoint of a progressive render
+//
+// Holds everything needed to continue a render: the radiance summed
+// over all iterations (not divided by their count), the number of
+// iterations, i.e. samples per pixel, and the random number generator
+// state of every thread. Algorithm, sampler and scene are stored to
+// refuse resuming a different job, samplers must not be mixed.
+//
+// File layout, little endian as written by the machine:
+//   "PG3C", version, algorithm, sampler, iterations,
+//   resolution x and y,
+//   scene name, radiance (3 floats per pixel, row major),
+//   flag and per pixel statistics of adaptive sampling,
+//   number of RNG states, RNG states (of the active sampler).
+// Strings are stored as their length followed by the characters.
+
+class Checkpoint
+{
+public:
+
+  enum { kVersion = 1 };
+
+  Checkpoint() :
+    mAlgorithm(0),
+    mSampler(-1),
+    mIterations(0)
+  {}
+
+  bool Save(const std::string &aFilename) const
+  {
+    std::ofstream file(aFilename.c_str(), std::ios::binary);
+
+    if(!file)
+      return false;
+
+    const Vec2f &resolution = mRadiance.GetResolution();
+
+    file.write("PG3C", 4);
+    writeInt(file, kVersion);
+    writeInt(file, mAlgorithm);
+    writeInt(file, mSampler);
+    writeInt(file, mIterations);
+    writeInt(file, int(resolution.x));
+    writeInt(file, int(resolution.y));
+    writeString(file, mSceneName);
+
+    mRadiance.WriteRaw(file);
+
+    writeInt(file, mRadiance.HasStatistics() ? 1 : 0);
+    if(mRadiance.HasStatistics())
+      mRadiance.WriteStatistics(file);
+
+    writeInt(file, int(mRngStates.size()));
+    for(size_t i=0; i<mRngStates.size(); i++)
+      writeString(file, mRngStates[i]);
+
+    // A full disk may only fail at the final flush
+    file.close();
+    return !file.fail();
+  }
+
+  bool Load(const std::string &aFilename)
+  {
+    std::ifstream file(aFilename.c_str(), std::ios::binary);
+
+    if(!file)
+      return false;
+
+    char magic[4];
+    file.read(magic, 4);
+
+    if(file.fail() || std::string(magic, 4) != "PG3C")
+      return false;
+
+    const int version = readInt(file);
+
+    if(version != kVersion)
+      return false;
+
+    mAlgorithm  = readInt(file);
+    mSampler    = readInt(file);
+    mIterations = readInt(file);
+
+    const int resX = readInt(file);
+    const int resY = readInt(file);
+
+    if(file.fail() || resX <= 0 || resY <= 0)
+      return false;
+
+    mSceneName = readString(file);
+
+    mRadiance.Setup(Vec2f(float(resX), float(resY)));
+    if(!mRadiance.ReadRaw(file))
+      return false;
+
+    if(readInt(file) != 0 && !mRadiance.ReadStatistics(file))
+      return false;
+
+    const int numRngStates = readInt(file);
+
+    if(file.fail() || numRngStates < 0)
+      return false;
+
+    mRngStates.resize(numRngStates);
+    for(int i=0; i<numRngStates; i++)
+      mRngStates[i] = readString(file);
+
+    return !file.fail();
+  }
+
+public:
+
+  int                      mAlgorithm;
+  int                      mSampler;    //!< SamplerType
+  int                      mIterations;
+  std::string              mSceneName;
+  Framebuffer              mRadiance;
+  std::vector<std::string> mRngStates;
+
+private:
+
+  static void writeInt(std::ostream &aStream, int aValue)
+  {
+    aStream.write(reinterpret_cast<const char*>(&aValue), sizeof(aValue));
+  }
+
+  static int readInt(std::istream &aStream)
+  {
+    int value = 0;
+    aStream.read(reinterpret_cast<char*>(&value), sizeof(value));
+    return value;
+  }
+
+  static void writeString(std::ostream &aStream, const std::string &aString)
+  {
+    writeInt(aStream, int(aString.length()));
+    aStream.write(aString.data(), aString.length());
+  }
+
+  static std::string readString(std::istream &aStream)
+  {
+    const int length = readInt(aStream);
+
+    if(aStream.fail() || length < 0 || length > (1 << 20))
+    {
+      aStream.setstate(std::ios::failbit);
+      return std::string();
+    }
+
+    std::string result(length, '\0');
+    if(length > 0)
+      aStream.read(&result[0], length);
+
+    return result;
+  }
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Checkpoint writer
+//
+// Writes checkpoints and the image so far on a background thread, so
+// rendering never waits for the disk. Only the newest submitted
+// checkpoint is kept; if the disk is slower than the checkpoint interval,
+// older ones are skipped. Files are written under a temporary name and
+// renamed, so a killed job always leaves the last complete checkpoint.
+
+class CheckpointWriter
+{
+public:
+
+  CheckpointWriter(
+    const std::string &aImageName,
+    const std::string &aCheckpointName) :
+    mImageName(aImageName),
+    mCheckpointName(aCheckpointName),
+    mHasPending(false),
+    mQuit(false)
+  {
+    mThread = std::thread(&CheckpointWriter::run, this);
+  }
+
+  // Writes the last submitted checkpoint, if any, before returning
+  ~CheckpointWriter()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mQuit = true;
+    }
+
+    mCondition.notify_one();
+    mThread.join();
+  }
+
+  // Takes over the content of aoCheckpoint, which is left empty
+  void Submit(Checkpoint &aoCheckpoint)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      std::swap(mPending, aoCheckpoint);
+      mHasPending = true;
+    }
+
+    mCondition.notify_one();
+  }
+
+private:
+
+  void run()
+  {
+    Checkpoint checkpoint;
+
+    for(;;)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        while(!mHasPending && !mQuit)
+          mCondition.wait(lock);
+
+        if(!mHasPending)
+          return;
+
+        std::swap(checkpoint, mPending);
+        mHasPending = false;
+      }
+
+      write(checkpoint);
+    }
+  }
+
+  void write(const Checkpoint &aCheckpoint) const
+  {
+    if(!replaceFile(mCheckpointName, aCheckpoint))
+      printf("\nFailed to write checkpoint %s\n", mCheckpointName.c_str());
+
+    if(aCheckpoint.mIterations <= 0)
+      return;
+
+    Framebuffer image = aCheckpoint.mRadiance;
+    image.DivideBySampleCount(aCheckpoint.mIterations);
+
+    const std::string tmpName = tempName(mImageName);
+    if(!image.Save(tmpName) || !CommitTempFile(tmpName, mImageName))
+    {
+      std::remove(tmpName.c_str());
+      printf("\nFailed to write image %s\n", mImageName.c_str());
+    }
+  }
+
+  static std::string tempName(const std::string &aFilename)
+  {
+    // Keeps the extension, Framebuffer::Save depends on it
+    const size_t dot = aFilename.rfind('.');
+
+    if(dot == std::string::npos)
+      return aFilename + ".tmp";
+
+    return aFilename.substr(0, dot) + ".tmp" + aFilename.substr(dot);
+  }
+
+  static bool replaceFile(
+    const std::string &aFilename,
+    const Checkpoint  &aCheckpoint)
+  {
+    const std::string tmpName = tempName(aFilename);
+
+    if(!aCheckpoint.Save(tmpName))
+    {
+      std::remove(tmpName.c_str());
+      return false;
+    }
+
+    return CommitTempFile(tmpName, aFilename);
+  }
+
+  std::string             mImageName;
+  std::string             mCheckpointName;
+
+  std::thread             mThread;
+  std::mutex              mMutex;
+  std::condition_variable mCondition;
+  Checkpoint              mPending;
+  bool                    mHasPending;
+  bool                    mQuit;
+};
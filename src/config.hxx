@@ -14,8 +14,12 @@
 #include "pathtracer.hxx"
 #include "pathtracer_direct.hxx"
 #include "pathtracer_global.hxx"
+#include "pathtracer_wavefront.hxx"
 #include "lighttracer.hxx"
 #include "bpt.hxx"
+#include "benchmark.hxx"
+#include "checkpoint.hxx"
+#include "stats.hxx"
 
 #include <omp.h>
 #include <string>
@@ -29,6 +33,7 @@ struct Config
   {
     kEyeLight,
     kPathTracing,
+    kPathTracingWavefront,
     kAlgorithmMax
   };
 
@@ -37,10 +42,11 @@ struct Config
     static const char* algorithmNames[7] =
     {
       "eye light",
-      "path tracing"
+      "path tracing",
+      "wavefront path tracing"
     };
 
-    if(aAlgorithm < 0 || aAlgorithm > 1)
+    if(aAlgorithm < 0 || aAlgorithm >= kAlgorithmMax)
       return "unknown algorithm";
 
     return algorithmNames[aAlgorithm];
@@ -48,9 +54,9 @@ struct Config
 
   static const char* GetAcronym(Algorithm aAlgorithm)
   {
-    static const char* algorithmNames[7] = { "el", "pt" };
+    static const char* algorithmNames[7] = { "el", "pt", "wpt" };
 
-    if(aAlgorithm < 0 || aAlgorithm > 1)
+    if(aAlgorithm < 0 || aAlgorithm >= kAlgorithmMax)
       return "unknown";
     return algorithmNames[aAlgorithm];
   }
@@ -66,6 +72,27 @@ struct Config
   uint        mMinPathLength;
   std::string mOutputName;
   Vec2i       mResolution;
+  bool        mUseTiles;
+  int         mTileSize;
+  bool        mBenchmarkBvh;
+  bool        mBenchmarkSimd;
+  bool        mUseSplatBuffer;
+  bool        mBenchmarkSplat;
+  bool        mBenchmarkSamplers;
+  bool        mBenchmarkRender;
+  bool        mCheckThreads;
+  RenderStats *mStats;
+  float       mCheckpointInterval;
+  std::string mCheckpointName;
+  bool        mResume;
+  const Checkpoint *mResumeFrom;
+  float       mAdaptiveThreshold;
+  int         mAdaptiveMinSamples;
+  int         mAdaptiveMaxSamples;
+  bool        mStopAtThreshold;
+  SamplerType mSampler;
+  std::string mMeshFile;
+  bool        mUseSceneCache;
 };
 
 // Utility function, essentially a renderer factory
@@ -93,6 +120,8 @@ AbstractRenderer* CreateRenderer(
 #else
     return new PathTracerDirect(scene, aSeed);
 #endif
+  case Config::kPathTracingWavefront:
+    return new PathTracerWavefront(scene, aSeed);
 
   default:
     printf("Unknown algorithm!!\n");
@@ -156,13 +185,20 @@ void PrintRngWarning()
 void PrintHelp(const char *argv[])
 {
   printf("\n");
-  printf("Usage: %s [ -s <scene_id> | -a <algorithm> |\n", argv[0]);
-  printf("           -t <time> | -i <iteration> | -o <output_name> | --report ]\n\n");
+  printf("Usage: %s [ -s <scene_id> | --mesh <file> | -a <algorithm> |\n", argv[0]);
+  printf("           -t <time> | -i <iteration> | -o <output_name> | --report |\n");
+  printf("           --checkpoint <seconds> | --resume |\n");
+  printf("           --adaptive <rel_error> | --target-error <rel_error> |\n");
+  printf("           --sampler <sampler> |\n");
+  printf("           --no-tiles | --no-splat-buffer | --no-scene-cache |\n");
+  printf("           --bench-bvh | --bench-simd | --bench-splat | --bench-sampler |\n");
+  printf("           --bench-render | --check-threads ]\n\n");
   printf("    -s  Selects the scene (default 0):\n");
 
   for(int i = 0; i < SizeOfArray(g_SceneConfigs); i++)
     printf("          %d    %s\n", i, Scene::GetSceneName(g_SceneConfigs[i]).c_str());
 
+  printf("    --mesh  Renders an .obj (with .mtl) or .ply file instead of a Cornell box\n");
   printf("    -a  Selects the rendering algorithm (default vcm):\n");
 
   for(int i = 0; i < (int)Config::kAlgorithmMax; i++)
@@ -173,6 +209,27 @@ void PrintHelp(const char *argv[])
   printf("    -t  Number of seconds to run the algorithm\n");
   printf("    -i  Number of iterations to run the algorithm (default 1)\n");
   printf("    -o  User specified output name, with extension .bmp or .hdr (default .bmp)\n");
+  printf("    --checkpoint      Every <seconds> writes the image so far and a checkpoint\n");
+  printf("                      <output_name>.ckpt, on a background thread\n");
+  printf("    --resume          Continues from <output_name>.ckpt, -i/-t give the additional work\n");
+  printf("    --adaptive        Pixels whose relative error drops below <rel_error> get no\n");
+  printf("                      more samples, -i is then the average samples per pixel\n");
+  printf("    --target-error    Adaptive sampling until all pixels are below <rel_error>\n");
+  printf("                      or have 4096 samples, replaces -i, -t still limits the time\n");
+  printf("    --sampler         Random numbers for rendering (default sobol):\n");
+  printf("                        stream  sequential Mersenne Twister, depends on thread scheduling\n");
+  printf("                        pcg     counter based hash of pixel, sample and dimension\n");
+  printf("                        sobol   Owen scrambled Sobol, keyed like pcg\n");
+  printf("    --no-tiles        Renders whole iterations per thread instead of sharing tiles\n");
+  printf("    --no-splat-buffer Light tracers splat into one framebuffer per thread\n");
+  printf("    --no-scene-cache  Parses the mesh, instead of mapping and writing <file>.pg3cache\n");
+  printf("    --bench-bvh       Runs the BVH scaling benchmark instead of rendering\n");
+  printf("    --bench-simd      Runs the scalar vs. SIMD intersection benchmark instead of rendering\n");
+  printf("    --bench-splat     Runs the splatting memory/throughput benchmark instead of rendering\n");
+  printf("    --bench-sampler   Runs the sampler speed/error benchmark instead of rendering\n");
+  printf("    --bench-render    Renders every scene with every algorithm for -i iterations and\n");
+  printf("                      prints timings as JSON, ray counts need RAY_STATS=1 at compile time\n");
+  printf("    --check-threads   Renders with 1, 2 and 4 threads and fails unless the images match\n");
   printf("\n    Note: Time (-t) takes precedence over iterations (-i) if both are defined\n");
 }
 
@@ -190,6 +247,27 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
   oConfig.mMaxPathLength = 10;
   oConfig.mMinPathLength = 0;
   oConfig.mResolution    = Vec2i(512, 512);
+  oConfig.mUseTiles      = true;                  // [cmd]
+  oConfig.mTileSize      = 32;
+  oConfig.mBenchmarkBvh  = false;                 // [cmd]
+  oConfig.mBenchmarkSimd = false;                 // [cmd]
+  oConfig.mUseSplatBuffer = true;                 // [cmd]
+  oConfig.mBenchmarkSplat = false;                // [cmd]
+  oConfig.mBenchmarkSamplers = false;             // [cmd]
+  oConfig.mBenchmarkRender   = false;             // [cmd]
+  oConfig.mCheckThreads      = false;             // [cmd]
+  oConfig.mStats             = NULL; // set by the benchmark suite
+  oConfig.mCheckpointInterval = -1.f;             // [cmd]
+  oConfig.mCheckpointName = "";
+  oConfig.mResume         = false;                // [cmd]
+  oConfig.mResumeFrom     = NULL; // set by main when resuming
+  oConfig.mAdaptiveThreshold  = -1.f;             // [cmd]
+  oConfig.mAdaptiveMinSamples = 8;
+  oConfig.mAdaptiveMaxSamples = 4096;
+  oConfig.mStopAtThreshold    = false;            // [cmd]
+  oConfig.mSampler            = kSamplerSobol;    // [cmd]
+  oConfig.mMeshFile           = "";               // [cmd] Replaces the Cornell box when set
+  oConfig.mUseSceneCache      = true;             // [cmd]
   //oConfig.mFramebuffer   = NULL; // this is never set by any parameter
 
   int sceneID    = 0; // default 0
@@ -227,6 +305,20 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
         return;
       }
     }
+    else if(arg == "--mesh") // mesh file to load
+    {
+      if(++i == argc)
+      {
+        printf("Missing <file> argument, please see help (-h)\n");
+        return;
+      }
+
+      oConfig.mMeshFile = argv[i];
+    }
+    else if(arg == "--no-scene-cache") // always parse the mesh
+    {
+      oConfig.mUseSceneCache = false;
+    }
     else if(arg == "-a") // algorithm to use
     {
       if(++i == argc)
@@ -282,6 +374,99 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
 
       oConfig.mIterations = -1; // time has precedence
     }
+    else if(arg == "--no-tiles") // parallelize over iterations only
+    {
+      oConfig.mUseTiles = false;
+    }
+    else if(arg == "--bench-bvh") // BVH scaling benchmark
+    {
+      oConfig.mBenchmarkBvh = true;
+    }
+    else if(arg == "--bench-simd") // packed geometry benchmark
+    {
+      oConfig.mBenchmarkSimd = true;
+    }
+    else if(arg == "--checkpoint") // progressive rendering with checkpoints
+    {
+      if(++i == argc)
+      {
+        printf("Missing <seconds> argument, please see help (-h)\n");
+        return;
+      }
+
+      std::istringstream iss(argv[i]);
+      iss >> oConfig.mCheckpointInterval;
+
+      if(iss.fail() || oConfig.mCheckpointInterval <= 0)
+      {
+        printf("Invalid <seconds> argument, please see help (-h)\n");
+        return;
+      }
+    }
+    else if(arg == "--resume") // continue from checkpoint
+    {
+      oConfig.mResume = true;
+    }
+    else if(arg == "--adaptive" || arg == "--target-error") // adaptive sampling
+    {
+      if(++i == argc)
+      {
+        printf("Missing <rel_error> argument, please see help (-h)\n");
+        return;
+      }
+
+      std::istringstream iss(argv[i]);
+      iss >> oConfig.mAdaptiveThreshold;
+
+      if(iss.fail() || oConfig.mAdaptiveThreshold <= 0)
+      {
+        printf("Invalid <rel_error> argument, please see help (-h)\n");
+        return;
+      }
+
+      oConfig.mStopAtThreshold = (arg == "--target-error");
+    }
+    else if(arg == "--sampler") // sampler used by the renderers
+    {
+      if(++i == argc)
+      {
+        printf("Missing <sampler> argument, please see help (-h)\n");
+        return;
+      }
+
+      const std::string name(argv[i]);
+      oConfig.mSampler = kSamplerMax;
+
+      for(int s=0; s<kSamplerMax; s++)
+        if(name == GetSamplerName(SamplerType(s)))
+          oConfig.mSampler = SamplerType(s);
+
+      if(oConfig.mSampler == kSamplerMax)
+      {
+        printf("Invalid <sampler> argument, please see help (-h)\n");
+        return;
+      }
+    }
+    else if(arg == "--no-splat-buffer") // per thread framebuffers for splatting
+    {
+      oConfig.mUseSplatBuffer = false;
+    }
+    else if(arg == "--bench-splat") // splat buffer benchmark
+    {
+      oConfig.mBenchmarkSplat = true;
+    }
+    else if(arg == "--bench-sampler") // sampler benchmark
+    {
+      oConfig.mBenchmarkSamplers = true;
+    }
+    else if(arg == "--bench-render") // benchmark suite of all scenes and algorithms
+    {
+      oConfig.mBenchmarkRender = true;
+    }
+    else if(arg == "--check-threads") // thread count independence check
+    {
+      oConfig.mCheckThreads = true;
+    }
     else if(arg == "-o") // number of seconds to run
     {
       if(++i == argc)
@@ -300,6 +485,13 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
     }
   }
 
+  // The benchmark suite compares runs of a fixed amount of work
+  if(oConfig.mBenchmarkRender && oConfig.mMaxTime > 0)
+  {
+    printf("--bench-render renders a fixed number of iterations, use -i instead of -t\n");
+    return;
+  }
+
   // Check algorithm was selected
   if(oConfig.mAlgorithm == Config::kAlgorithmMax)
   {
@@ -308,7 +500,27 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
 
   // Load scene
   Scene *scene = new Scene;
-  scene->LoadCornellBox(oConfig.mResolution, g_SceneConfigs[sceneID]);
+
+  if(oConfig.mMeshFile.length() > 0)
+  {
+    const double startT = omp_get_wtime();
+    bool fromCache = false;
+
+    if(!scene->LoadMesh(oConfig.mMeshFile, oConfig.mResolution,
+      oConfig.mUseSceneCache, &fromCache))
+    {
+      delete scene;
+      return;
+    }
+
+    printf("Loaded:  %s, %d triangles, %d lights in %.3f s%s\n",
+      oConfig.mMeshFile.c_str(),
+      static_cast<const TriangleMesh*>(scene->mGeometry)->GetTriangleCount(),
+      scene->GetLightCount(), omp_get_wtime() - startT,
+      fromCache ? " (scene cache)" : "");
+  }
+  else
+    scene->LoadCornellBox(oConfig.mResolution, g_SceneConfigs[sceneID]);
 
   oConfig.mScene = scene;
 
@@ -328,4 +540,8 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
 
   if(extension != ".bmp" && extension != ".hdr")
     oConfig.mOutputName += ".bmp";
+
+  // Checkpoint is stored next to the image
+  oConfig.mCheckpointName = oConfig.mOutputName.substr(
+    0, oConfig.mOutputName.length() - 4) + ".ckpt";
 }
@@ -14,20 +14,29 @@ public:
     const Scene& aScene,
     int aSeed = 1234
     ) :
-  AbstractRenderer(aScene), mRng(aSeed)
+  AbstractRenderer(aScene, aSeed)
   {}
 
-  virtual void RunIteration(int aIteration)
+  virtual void RunTile(
+    const Tile  &aTile,
+    int         aIteration,
+    Framebuffer &oFramebuffer)
   {
-    const int resX = int(mScene.mCamera.mResolution.x);
-    const int resY = int(mScene.mCamera.mResolution.y);
+    const int resX     = int(mScene.mCamera.mResolution.x);
+    const int tileResX = aTile.mX1 - aTile.mX0;
+    const int tileResY = aTile.mY1 - aTile.mY0;
 
-    for(int pixID = 0; pixID < resX * resY; pixID++)
+    for(int pixID = 0; pixID < tileResX * tileResY; pixID++)
     {
       //////////////////////////////////////////////////////////////////////////
       // Generate ray
-      const int x = pixID % resX;
-      const int y = pixID / resX;
+      const int x = aTile.mX0 + pixID % tileResX;
+      const int y = aTile.mY0 + pixID / tileResX;
+
+      if(!oFramebuffer.IsActive(x, y))
+        continue;
+
+      mRng.StartSample(uint(x + y * resX), uint(aIteration));
 
       const Vec2f sample = Vec2f(float(x), float(y)) +
         (aIteration == 1 ? Vec2f(0.5f) : mRng.GetVec2f());
@@ -41,14 +50,10 @@ public:
         float dotLN = Dot(isect.normal, -ray.dir);
 
         if(dotLN > 0)
-          mFramebuffer.AddColor(sample, Vec3f(dotLN));
+          oFramebuffer.AddColor(sample, Vec3f(dotLN));
         else
-          mFramebuffer.AddColor(sample, Vec3f(-dotLN, 0, 0));
+          oFramebuffer.AddColor(sample, Vec3f(-dotLN, 0, 0));
       }
     }
-
-    mIterations++;
   }
-
-  Rng              mRng;
 };
@@ -3,6 +3,9 @@
 #include <vector>
 #include <cmath>
 #include <fstream>
+#include <string>
+#include <limits>
+#include <algorithm>
 #include <string.h>
 #include "utils.hxx"
 
@@ -10,7 +13,10 @@ class Framebuffer
 {
 public:
 
-  Framebuffer()
+  Framebuffer() :
+    mResolution(0.f),
+    mResX(0),
+    mResY(0)
   {}
 
   //////////////////////////////////////////////////////////////////////////
@@ -29,6 +35,10 @@ public:
     int y = int(aSample.y);
 
     mColor[x + y * mResX] = mColor[x + y * mResX] + aColor;
+
+    // Every AddColor is assumed to be one complete sample of the pixel
+    if(!mLuminanceSqr.empty())
+      mLuminanceSqr[x + y * mResX] += Sqr(Luminance(aColor));
   }
 
   //////////////////////////////////////////////////////////////////////////
@@ -39,6 +49,9 @@ public:
     mResX = int(aResolution.x);
     mResY = int(aResolution.y);
     mColor.resize(mResX * mResY);
+    mLuminanceSqr.clear();
+    mSampleCount.clear();
+    mActive.clear();
     Clear();
   }
 
@@ -47,6 +60,24 @@ public:
     memset(&mColor[0], 0, sizeof(Vec3f) * mColor.size());
   }
 
+  // Divides every pixel by its number of samples. Without statistics
+  // every pixel has aIterations samples.
+  void DivideBySampleCount(int aIterations)
+  {
+    if(!HasStatistics())
+    {
+      if(aIterations > 0)
+        Scale(1.f / aIterations);
+      return;
+    }
+
+    for(size_t i=0; i<mColor.size(); i++)
+    {
+      if(mSampleCount[i] > 0)
+        mColor[i] = mColor[i] * Vec3f(1.f / mSampleCount[i]);
+    }
+  }
+
   void Add(const Framebuffer& aOther)
   {
     for(size_t i=0; i<mColor.size(); i++)
@@ -59,6 +90,164 @@ public:
       mColor[i] = mColor[i] * Vec3f(aScale);
   }
 
+  const Vec2f& GetResolution() const
+  {
+    return mResolution;
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // Per pixel statistics for adaptive sampling. Tracks the second moment
+  // of the pixel luminance, the number of samples and which pixels still
+  // need samples. Renderers skip pixels for which IsActive is false,
+  // whoever drives them has to call CountSamples after every iteration.
+  void SetupStatistics()
+  {
+    mLuminanceSqr.assign(mColor.size(), 0.f);
+    mSampleCount.assign(mColor.size(), 0);
+    mActive.assign(mColor.size(), 1);
+  }
+
+  bool HasStatistics() const
+  {
+    return !mSampleCount.empty();
+  }
+
+  bool IsActive(int aX, int aY) const
+  {
+    return mActive.empty() || mActive[aX + aY * mResX] != 0;
+  }
+
+  // Active pixels got one more sample
+  void CountSamples()
+  {
+    for(size_t i=0; i<mSampleCount.size(); i++)
+      mSampleCount[i] += mActive[i];
+  }
+
+  // Relative standard error of the pixel luminance estimate
+  float GetRelativeError(int aIndex) const
+  {
+    const int count = mSampleCount[aIndex];
+
+    if(count < 2)
+      return std::numeric_limits<float>::infinity();
+
+    const float mean   = Luminance(mColor[aIndex]) / count;
+    const float meanSq = mLuminanceSqr[aIndex] / count;
+
+    // Sample variance, the mean of its estimate is the variance
+    const float variance = std::max(0.f, meanSq - Sqr(mean)) * count / (count - 1);
+
+    if(variance == 0.f)
+      return 0.f;
+
+    return std::sqrt(variance / count) / std::max(mean, 1e-4f);
+  }
+
+  // Deactivates pixels whose relative error is below aThreshold, after
+  // all pixels have aMinSamples. A pixel also stays active when one of
+  // its 8 neighbors is above the threshold, error estimates of single
+  // pixels that have not seen a rare bright path yet are too optimistic.
+  // Pixels with aMaxSamples are done regardless, some never converge.
+  // Returns the number of active pixels.
+  int UpdateActive(
+    float aThreshold,
+    int   aMinSamples,
+    int   aMaxSamples)
+  {
+    for(size_t i=0; i<mActive.size(); i++)
+    {
+      mActive[i] = mSampleCount[i] < aMinSamples ||
+        GetRelativeError(int(i)) > aThreshold;
+    }
+
+    // Dilation, first along rows then along columns
+    std::vector<char> rows(mActive.size());
+
+    for(int y=0; y<mResY; y++)
+    {
+      for(int x=0; x<mResX; x++)
+      {
+        const char *pixel = &mActive[x + y * mResX];
+        rows[x + y * mResX] = pixel[0] |
+          (x > 0 ? pixel[-1] : 0) | (x + 1 < mResX ? pixel[1] : 0);
+      }
+    }
+
+    int active = 0;
+
+    for(int y=0; y<mResY; y++)
+    {
+      for(int x=0; x<mResX; x++)
+      {
+        const char *pixel = &rows[x + y * mResX];
+        mActive[x + y * mResX] = (pixel[0] |
+          (y > 0 ? pixel[-mResX] : 0) | (y + 1 < mResY ? pixel[mResX] : 0)) &&
+          mSampleCount[x + y * mResX] < aMaxSamples;
+        active += mActive[x + y * mResX];
+      }
+    }
+
+    return active;
+  }
+
+  long long GetTotalSampleCount() const
+  {
+    long long total = 0;
+
+    for(size_t i=0; i<mSampleCount.size(); i++)
+      total += mSampleCount[i];
+
+    return total;
+  }
+
+  int GetActiveCount() const
+  {
+    int active = 0;
+
+    for(size_t i=0; i<mActive.size(); i++)
+      active += mActive[i];
+
+    return active;
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // Raw radiance, used by checkpoints. Read expects Setup to be done.
+  void WriteRaw(std::ostream &aStream) const
+  {
+    aStream.write(reinterpret_cast<const char*>(&mColor[0]),
+      mColor.size() * sizeof(Vec3f));
+  }
+
+  bool ReadRaw(std::istream &aStream)
+  {
+    aStream.read(reinterpret_cast<char*>(&mColor[0]),
+      mColor.size() * sizeof(Vec3f));
+
+    return !aStream.fail();
+  }
+
+  // Statistics, Write expects HasStatistics, Read sets them up
+  void WriteStatistics(std::ostream &aStream) const
+  {
+    aStream.write(reinterpret_cast<const char*>(&mLuminanceSqr[0]),
+      mLuminanceSqr.size() * sizeof(float));
+    aStream.write(reinterpret_cast<const char*>(&mSampleCount[0]),
+      mSampleCount.size() * sizeof(int));
+  }
+
+  bool ReadStatistics(std::istream &aStream)
+  {
+    SetupStatistics();
+
+    aStream.read(reinterpret_cast<char*>(&mLuminanceSqr[0]),
+      mLuminanceSqr.size() * sizeof(float));
+    aStream.read(reinterpret_cast<char*>(&mSampleCount[0]),
+      mSampleCount.size() * sizeof(int));
+
+    return !aStream.fail();
+  }
+
   //////////////////////////////////////////////////////////////////////////
   // Statistics
   float TotalLuminance()
@@ -76,8 +265,43 @@ public:
     return lum;
   }
 
+  // Largest difference of a color channel to aOther, relative to the
+  // larger of both values. 0 when the images are identical.
+  float GetMaxRelativeDifference(const Framebuffer& aOther) const
+  {
+    float result = 0.f;
+
+    for(size_t i=0; i<mColor.size(); i++)
+    {
+      for(int j=0; j<3; j++)
+      {
+        const float a = mColor[i].Get(j);
+        const float b = aOther.mColor[i].Get(j);
+
+        if(a != b)
+          result = std::max(result, std::abs(a - b) / std::max(std::abs(a), std::abs(b)));
+      }
+    }
+
+    return result;
+  }
+
   //////////////////////////////////////////////////////////////////////////
-  // Saving
+  // Saving, the format is given by the extension (.bmp or .hdr).
+  // Returns false for an unknown extension or when writing fails.
+  bool Save(const std::string &aFilename)
+  {
+    const std::string extension = aFilename.length() >= 3 ?
+      aFilename.substr(aFilename.length() - 3, 3) : std::string();
+
+    if(extension == "bmp")
+      return SaveBMP(aFilename.c_str(), 2.2f /*gamma*/);
+    if(extension == "hdr")
+      return SaveHDR(aFilename.c_str());
+
+    return false;
+  }
+
   void SavePPM(
     const char *aFilename,
     float       aGamma = 1.f)
@@ -142,7 +366,7 @@ public:
     uint   mImportantColors; // 0 - all are important
   };
 
-  void SaveBMP(
+  bool SaveBMP(
     const char *aFilename,
     float       aGamma = 1.f)
   {
@@ -187,11 +411,15 @@ public:
         bmp.write((char*)&bgrB, sizeof(bgrB));
       }
     }
+
+    // Errors of the final flush only show after close
+    bmp.close();
+    return !bmp.fail();
   }
 
   //////////////////////////////////////////////////////////////////////////
   // Saving HDR
-  void SaveHDR(const char* aFilename)
+  bool SaveHDR(const char* aFilename)
   {
     std::ofstream hdr(aFilename, std::ios::binary);
 
@@ -223,11 +451,17 @@ public:
         hdr.write((char*)&rgbe[0], 4);
       }
     }
+
+    hdr.close();
+    return !hdr.fail();
   }
 
 private:
 
   std::vector<Vec3f> mColor;
+  std::vector<float> mLuminanceSqr;
+  std::vector<int>   mSampleCount;
+  std::vector<char>  mActive;
   Vec2f              mResolution;
   int                mResX;
   int                mResY;
@@ -301,6 +301,17 @@ public:
     Vec3f &aoBBoxMin,
     Vec3f &aoBBoxMax)
   {
+    // Conservative box around both caps
+    const Vec3f centers[2] = { centerBottom, centerTop };
+
+    for(int i=0; i<2; i++)
+    {
+      for(int j=0; j<3; j++)
+      {
+        aoBBoxMin.Get(j) = std::min(aoBBoxMin.Get(j), centers[i].Get(j) - outerRadius);
+        aoBBoxMax.Get(j) = std::max(aoBBoxMax.Get(j), centers[i].Get(j) + outerRadius);
+      }
+    }
   }
 
 public:
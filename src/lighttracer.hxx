@@ -15,6 +15,10 @@ public:
   PathTracer(aScene, aSeed)
   {}
 
+  virtual bool SupportsTiles() const { return false; }
+
+  virtual bool SupportsSplatting() const { return true; }
+
   Vec3f CameraDir(Vec3f worldPt)
   {
     return Normalize(mScene.mCamera.mPosition - worldPt);
@@ -25,11 +29,11 @@ public:
     const Vec3f cameraRay = mScene.mCamera.mPosition - worldPt;
     const Vec2f rasterHit = mScene.mCamera.WorldToRaster(worldPt);
     float cosToCamera = Dot(Normalize(-cameraRay), this->mScene.mCamera.mForward);
-    mFramebuffer.AddColor(rasterHit, radiance
-                                      * (1.0f/cameraRay.LenSqr())
-                                      * 1.0f/Sqr(cosToCamera)
-                                      * 1.0f/cosToCamera
-                                      * 1.0f / Sqr(2.0f * tan(22.5f/360.0f * 2.0f * PI_F)));
+    splat(rasterHit, radiance
+                         * (1.0f/cameraRay.LenSqr())
+                         * 1.0f/Sqr(cosToCamera)
+                         * 1.0f/cosToCamera
+                         * 1.0f / Sqr(2.0f * tan(22.5f/360.0f * 2.0f * PI_F)));
   }
 
   virtual void RunIteration(int aIteration)
@@ -41,6 +45,9 @@ public:
     {
       for (int lightID = 0; lightID < mScene.GetLightCount(); lightID++)
       {
+        mRng.StartSample(uint(pixID) * uint(mScene.GetLightCount()) + uint(lightID), uint(aIteration));
+
+        STATS_COUNT(kStatLightPaths);
         float pdfA, pdfW;
         Ray   ray = mScene.GetLightPtr(lightID)->generateRay(this->mRng, &pdfA, &pdfW);
 
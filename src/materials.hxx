@@ -2,6 +2,7 @@
 
 #include "math.hxx"
 #include "rng.hxx"
+#include "stats.hxx"
 
 class Material
 {
@@ -47,6 +48,7 @@ private:
 public:
   virtual Vec3f sampleBrdfHemisphere(const Vec2f &sample, float* oPdf, Vec3f* oBrdf, const Vec3f& wol, Rng& rng) const
   {
+    STATS_COUNT(kStatBrdfSamples);
     Vec3f dir;
     float pdf;
 
@@ -142,6 +144,7 @@ class MaterialMirror : public Material
   Vec3f sampleBrdfHemisphere(const Vec2f &sample, float* oPdf, Vec3f* oBrdf, const Vec3f& wol, Rng& rng) const override
   {
     // normal = (0,0,1)
+    STATS_COUNT(kStatBrdfSamples);
 
     *oPdf = 1;
     *oBrdf = this->mPhongReflectance;
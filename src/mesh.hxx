@@ -0,0 +1,252 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include "math.hxx"
+#include "ray.hxx"
+#include "geometry.hxx"
+#include "bvh.hxx"
+
+//////////////////////////////////////////////////////////////////////////
+// Indexed triangle mesh
+//
+// Vertices are stored once and triangles reference them by index, with
+// one material ID per triangle. The mesh has its own BVH over triangle
+// indices, no AbstractGeometry object is created per triangle. Arrays
+// are either owned (after Build) or external, e.g. inside a memory
+// mapped scene cache, which must then outlive the mesh.
+//
+// Triangles are one sided exactly like Triangle, the front side is the
+// one from which p0, p1, p2 appear counter clockwise.
+
+class TriangleMesh : public AbstractGeometry
+{
+public:
+
+  TriangleMesh() :
+    mVertices(NULL),
+    mIndices(NULL),
+    mMatIDs(NULL),
+    mNodes(NULL),
+    mNumVertices(0),
+    mNumTriangles(0),
+    mNumNodes(0)
+  {}
+
+  // Takes over the arrays (left empty) and builds the BVH. Triangles are
+  // reordered so that every leaf references a contiguous range of them.
+  void Build(
+    std::vector<Vec3f> &aoVertices,
+    std::vector<uint>  &aoIndices,
+    std::vector<int>   &aoMatIDs)
+  {
+    const int numTriangles = (int)aoMatIDs.size();
+
+    std::vector<BBox> boxes(numTriangles);
+    for(int i=0; i<numTriangles; i++)
+    {
+      for(int k=0; k<3; k++)
+        boxes[i].Grow(aoVertices[aoIndices[3 * i + k]]);
+    }
+
+    std::vector<int> order;
+    BVHBuilder(false).Build(boxes, mOwnedNodes, order);
+
+    mOwnedVertices.swap(aoVertices);
+    mOwnedIndices.resize(3 * numTriangles);
+    mOwnedMatIDs.resize(numTriangles);
+
+    for(int i=0; i<numTriangles; i++)
+    {
+      for(int k=0; k<3; k++)
+        mOwnedIndices[3 * i + k] = aoIndices[3 * order[i] + k];
+
+      mOwnedMatIDs[i] = aoMatIDs[order[i]];
+    }
+
+    aoIndices.clear();
+    aoMatIDs.clear();
+
+    mNumVertices  = (int)mOwnedVertices.size();
+    mNumTriangles = numTriangles;
+    mNumNodes     = (int)mOwnedNodes.size();
+    mVertices     = mNumVertices  > 0 ? &mOwnedVertices[0] : NULL;
+    mIndices      = mNumTriangles > 0 ? &mOwnedIndices[0]  : NULL;
+    mMatIDs       = mNumTriangles > 0 ? &mOwnedMatIDs[0]   : NULL;
+    mNodes        = mNumNodes     > 0 ? &mOwnedNodes[0]    : NULL;
+  }
+
+  // Uses arrays owned by the caller, triangles must already be in the
+  // leaf order of aNodes (as stored by Build)
+  void SetExternal(
+    const Vec3f   *aVertices,
+    int           aNumVertices,
+    const uint    *aIndices,
+    const int     *aMatIDs,
+    int           aNumTriangles,
+    const BVHNode *aNodes,
+    int           aNumNodes)
+  {
+    mOwnedVertices.clear();
+    mOwnedIndices.clear();
+    mOwnedMatIDs.clear();
+    mOwnedNodes.clear();
+
+    mVertices     = aVertices;
+    mIndices      = aIndices;
+    mMatIDs       = aMatIDs;
+    mNodes        = aNodes;
+    mNumVertices  = aNumVertices;
+    mNumTriangles = aNumTriangles;
+    mNumNodes     = aNumNodes;
+  }
+
+  virtual bool Intersect(
+    const Ray &aRay,
+    Isect     &oResult) const
+  {
+    // The root of an empty mesh is an empty leaf, not traversable
+    if(mNumTriangles == 0)
+      return false;
+
+    return BVHTraversal::Intersect(mNodes, aRay, oResult, MeshLeaf(*this));
+  }
+
+  virtual bool IntersectP(
+    const Ray &aRay,
+    Isect     &oResult) const
+  {
+    if(mNumTriangles == 0)
+      return false;
+
+    return BVHTraversal::IntersectP(mNodes, aRay, oResult, MeshLeaf(*this));
+  }
+
+  virtual void GrowBBox(
+    Vec3f &aoBBoxMin,
+    Vec3f &aoBBoxMax)
+  {
+    if(mNumNodes == 0 || mNodes[0].mBox.IsEmpty())
+      return;
+
+    for(int j=0; j<3; j++)
+    {
+      aoBBoxMin.Get(j) = std::min(aoBBoxMin.Get(j), mNodes[0].mBox.mMin.Get(j));
+      aoBBoxMax.Get(j) = std::max(aoBBoxMax.Get(j), mNodes[0].mBox.mMax.Get(j));
+    }
+  }
+
+  void GetTriangle(
+    int   aTriangle,
+    Vec3f &oP0,
+    Vec3f &oP1,
+    Vec3f &oP2) const
+  {
+    oP0 = mVertices[mIndices[3 * aTriangle + 0]];
+    oP1 = mVertices[mIndices[3 * aTriangle + 1]];
+    oP2 = mVertices[mIndices[3 * aTriangle + 2]];
+  }
+
+  int GetVertexCount()   const { return mNumVertices; }
+  int GetTriangleCount() const { return mNumTriangles; }
+  int GetNodeCount()     const { return mNumNodes; }
+
+  const Vec3f*   GetVertices() const { return mVertices; }
+  const uint*    GetIndices()  const { return mIndices; }
+  const int*     GetMatIDs()   const { return mMatIDs; }
+  const BVHNode* GetNodes()    const { return mNodes; }
+
+private:
+
+  // Same test as Triangle::Intersect, the normal is not stored but
+  // computed per test. It is only normalized for the reported hit.
+  bool intersectTriangle(
+    int       aTriangle,
+    const Ray &aRay,
+    Isect     &oResult) const
+  {
+    const Vec3f &p0 = mVertices[mIndices[3 * aTriangle + 0]];
+    const Vec3f &p1 = mVertices[mIndices[3 * aTriangle + 1]];
+    const Vec3f &p2 = mVertices[mIndices[3 * aTriangle + 2]];
+
+    const Vec3f normal = Cross(p1 - p0, p2 - p0);
+    const float dirDotNormal = Dot(aRay.dir, normal);
+
+    if(dirDotNormal > 0)
+      return false;
+
+    const Vec3f ao = p0 - aRay.org;
+    const Vec3f bo = p1 - aRay.org;
+    const Vec3f co = p2 - aRay.org;
+
+    const Vec3f v0 = Cross(co, bo);
+    const Vec3f v1 = Cross(bo, ao);
+    const Vec3f v2 = Cross(ao, co);
+
+    const float v0d = Dot(v0, aRay.dir);
+    const float v1d = Dot(v1, aRay.dir);
+    const float v2d = Dot(v2, aRay.dir);
+
+    if(((v0d < 0.f)  && (v1d < 0.f)  && (v2d < 0.f)) ||
+      ((v0d >= 0.f) && (v1d >= 0.f) && (v2d >= 0.f)))
+    {
+      const float distance = Dot(normal, ao) / dirDotNormal;
+
+      if((distance > aRay.tmin) & (distance < oResult.dist))
+      {
+        oResult.normal = Normalize(normal);
+        oResult.matID  = mMatIDs[aTriangle];
+        oResult.dist   = distance;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // Leaf test of BVHTraversal, primitives are triangle indices
+  struct MeshLeaf
+  {
+    explicit MeshLeaf(const TriangleMesh &aMesh) : mMesh(aMesh)
+    {}
+
+    bool Intersect(int aOffset, int aCount, const Ray &aRay, Isect &oResult) const
+    {
+      bool anyIntersection = false;
+
+      for(int i=aOffset; i<aOffset + aCount; i++)
+      {
+        if(mMesh.intersectTriangle(i, aRay, oResult))
+          anyIntersection = true;
+      }
+
+      return anyIntersection;
+    }
+
+    bool IntersectP(int aOffset, int aCount, const Ray &aRay, Isect &oResult) const
+    {
+      for(int i=aOffset; i<aOffset + aCount; i++)
+      {
+        if(mMesh.intersectTriangle(i, aRay, oResult))
+          return true;
+      }
+
+      return false;
+    }
+
+    const TriangleMesh &mMesh;
+  };
+
+  const Vec3f   *mVertices;
+  const uint    *mIndices;
+  const int     *mMatIDs;
+  const BVHNode *mNodes;
+  int           mNumVertices;
+  int           mNumTriangles;
+  int           mNumNodes;
+
+  std::vector<Vec3f>   mOwnedVertices;
+  std::vector<uint>    mOwnedIndices;
+  std::vector<int>     mOwnedMatIDs;
+  std::vector<BVHNode> mOwnedNodes;
+};
@@ -0,0 +1,647 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "math.hxx"
+
+//////////////////////////////////////////////////////////////////////////
+// Mesh loading
+//
+// Streaming readers of Wavefront OBJ (with MTL materials) and PLY (ascii
+// and binary), the file is read line by line or value by value and only
+// the indexed vertex and triangle arrays are kept. Polygons are split
+// into triangle fans. Both formats are y up by convention, the renderer
+// is z up, so positions are rotated on load.
+
+// Material as read from the file, mapped onto Material/AreaLight by Scene
+struct MeshMaterial
+{
+  MeshMaterial() :
+    mDiffuse(0.8f),
+    mGlossy(0.f),
+    mExponent(1.f),
+    mEmission(0.f),
+    mMirror(false)
+  {}
+
+  std::string mName;
+  Vec3f       mDiffuse;
+  Vec3f       mGlossy;
+  float       mExponent;
+  Vec3f       mEmission;
+  bool        mMirror;
+};
+
+struct MeshData
+{
+  std::vector<Vec3f>        mVertices;
+  std::vector<uint>         mIndices;   //!< 3 per triangle
+  std::vector<int>          mMaterials; //!< Index into mMaterialList per triangle
+  std::vector<MeshMaterial> mMaterialList;
+  std::vector<std::string>  mLibraries; //!< Referenced MTL files, also missing ones
+};
+
+namespace MeshLoader
+{
+  // y up to z up, a rotation so the triangle winding is kept
+  inline Vec3f ToZUp(float aX, float aY, float aZ)
+  {
+    return Vec3f(aX, -aZ, aY);
+  }
+
+  inline std::string GetExtension(const std::string &aFilename)
+  {
+    const size_t dot = aFilename.rfind('.');
+
+    if(dot == std::string::npos)
+      return "";
+
+    std::string extension = aFilename.substr(dot + 1);
+    for(size_t i=0; i<extension.length(); i++)
+      extension[i] = char(tolower(extension[i]));
+
+    return extension;
+  }
+
+  inline std::string GetDirectory(const std::string &aFilename)
+  {
+    const size_t slash = aFilename.find_last_of("/\\");
+
+    if(slash == std::string::npos)
+      return "";
+
+    return aFilename.substr(0, slash + 1);
+  }
+
+  // getline of a file with CRLF line ends leaves the '\r'
+  inline void StripCarriageReturn(std::string &aoLine)
+  {
+    if(!aoLine.empty() && aoLine[aoLine.length() - 1] == '\r')
+      aoLine.erase(aoLine.length() - 1);
+  }
+
+  // Triangle fan over aPolygon, which holds vertex indices
+  inline void AddPolygon(
+    const std::vector<uint> &aPolygon,
+    int                     aMaterial,
+    MeshData                &aoMesh)
+  {
+    for(size_t i=2; i<aPolygon.size(); i++)
+    {
+      aoMesh.mIndices.push_back(aPolygon[0]);
+      aoMesh.mIndices.push_back(aPolygon[i-1]);
+      aoMesh.mIndices.push_back(aPolygon[i]);
+      aoMesh.mMaterials.push_back(aMaterial);
+    }
+  }
+
+  // Keeps the material energy conserving, as Scene::SetMaterial does
+  inline void NormalizeMaterial(MeshMaterial &aoMaterial)
+  {
+    const float sum = aoMaterial.mDiffuse.Max() + aoMaterial.mGlossy.Max();
+
+    if(sum > 1.f)
+    {
+      aoMaterial.mDiffuse /= sum;
+      aoMaterial.mGlossy  /= sum;
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // OBJ
+
+  // Reads newmtl, Kd, Ks, Ns, Ke and illum (3 and 5 are mirrors).
+  // Appends to aoMaterials, aoNames maps names to their index.
+  inline bool LoadMtl(
+    const std::string          &aFilename,
+    std::vector<MeshMaterial>  &aoMaterials,
+    std::map<std::string, int> &aoNames)
+  {
+    std::ifstream file(aFilename.c_str());
+
+    if(!file)
+      return false;
+
+    std::string line;
+    MeshMaterial *material = NULL;
+
+    while(std::getline(file, line))
+    {
+      std::istringstream iss(line);
+      std::string keyword;
+      iss >> keyword;
+
+      if(keyword == "newmtl")
+      {
+        MeshMaterial newMaterial;
+        iss >> newMaterial.mName;
+
+        aoNames[newMaterial.mName] = (int)aoMaterials.size();
+        aoMaterials.push_back(newMaterial);
+        material = &aoMaterials.back();
+      }
+      else if(material == NULL)
+        continue;
+      else if(keyword == "Kd")
+        iss >> material->mDiffuse.x >> material->mDiffuse.y >> material->mDiffuse.z;
+      else if(keyword == "Ks")
+        iss >> material->mGlossy.x >> material->mGlossy.y >> material->mGlossy.z;
+      else if(keyword == "Ke")
+        iss >> material->mEmission.x >> material->mEmission.y >> material->mEmission.z;
+      else if(keyword == "Ns")
+        iss >> material->mExponent;
+      else if(keyword == "illum")
+      {
+        int illum = 0;
+        iss >> illum;
+        material->mMirror = (illum == 3 || illum == 5);
+      }
+    }
+
+    for(size_t i=0; i<aoMaterials.size(); i++)
+    {
+      MeshMaterial &result = aoMaterials[i];
+
+      // Mirrors reflect Ks, as MaterialMirror does mPhongReflectance
+      if(result.mMirror)
+      {
+        result.mDiffuse = Vec3f(0.f);
+        if(result.mGlossy.Max() <= 0)
+          result.mGlossy = Vec3f(1.f);
+      }
+
+      NormalizeMaterial(result);
+    }
+
+    return true;
+  }
+
+  // Parses the vertex index of a face corner "v", "v/vt", "v//vn" or
+  // "v/vt/vn", negative indices count from the last vertex
+  inline bool ParseFaceIndex(
+    const char *aToken,
+    int        aNumVertices,
+    uint       &oIndex)
+  {
+    char *end = NULL;
+    const long index = strtol(aToken, &end, 10);
+
+    if(end == aToken)
+      return false;
+
+    const long resolved = index < 0 ? aNumVertices + index : index - 1;
+
+    if(resolved < 0 || resolved >= aNumVertices)
+      return false;
+
+    oIndex = uint(resolved);
+    return true;
+  }
+
+  inline bool LoadObj(
+    const std::string &aFilename,
+    MeshData          &oMesh)
+  {
+    std::ifstream file(aFilename.c_str());
+
+    if(!file)
+    {
+      printf("Cannot open %s\n", aFilename.c_str());
+      return false;
+    }
+
+    std::map<std::string, int> materialNames;
+    std::vector<uint> polygon;
+    std::string line;
+    int material = -1;
+    int lineNumber = 0;
+
+    // Faces without material use the default one
+    oMesh.mMaterialList.push_back(MeshMaterial());
+    oMesh.mMaterialList.back().mName = "default";
+
+    while(std::getline(file, line))
+    {
+      lineNumber++;
+
+      const char *str = line.c_str();
+      while(*str == ' ' || *str == '\t')
+        str++;
+
+      if(str[0] == 'v' && (str[1] == ' ' || str[1] == '\t'))
+      {
+        char *end = NULL;
+        const float x = strtof(str + 2, &end);
+        const float y = strtof(end, &end);
+        const float z = strtof(end, &end);
+        oMesh.mVertices.push_back(ToZUp(x, y, z));
+      }
+      else if(str[0] == 'f' && (str[1] == ' ' || str[1] == '\t'))
+      {
+        polygon.clear();
+        str += 2;
+
+        for(;;)
+        {
+          while(*str == ' ' || *str == '\t' || *str == '\r')
+            str++;
+
+          if(*str == '\0')
+            break;
+
+          uint index;
+          if(!ParseFaceIndex(str, (int)oMesh.mVertices.size(), index))
+          {
+            printf("%s:%d: invalid face\n", aFilename.c_str(), lineNumber);
+            return false;
+          }
+
+          polygon.push_back(index);
+
+          while(*str != '\0' && *str != ' ' && *str != '\t' && *str != '\r')
+            str++;
+        }
+
+        AddPolygon(polygon, material < 0 ? 0 : material, oMesh);
+      }
+      else if(strncmp(str, "usemtl", 6) == 0)
+      {
+        std::istringstream iss(str + 6);
+        std::string name;
+        iss >> name;
+
+        std::map<std::string, int>::const_iterator it = materialNames.find(name);
+        material = (it != materialNames.end()) ? it->second : 0;
+      }
+      else if(strncmp(str, "mtllib", 6) == 0)
+      {
+        std::istringstream iss(str + 6);
+        std::string name;
+        iss >> name;
+
+        const std::string library = GetDirectory(aFilename) + name;
+        oMesh.mLibraries.push_back(library);
+
+        if(!LoadMtl(library, oMesh.mMaterialList, materialNames))
+          printf("Cannot open material library %s, using default material\n", name.c_str());
+      }
+    }
+
+    return true;
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // PLY
+
+  enum PlyType
+  {
+    kPlyInt8, kPlyUint8, kPlyInt16, kPlyUint16,
+    kPlyInt32, kPlyUint32, kPlyFloat32, kPlyFloat64,
+    kPlyNone
+  };
+
+  // Longest list read, larger counts are taken for corrupt data
+  enum { kPlyMaxListSize = 1 << 16 };
+
+  // Resolved once per property, not per value
+  inline PlyType GetPlyType(const std::string &aName)
+  {
+    if(aName == "char"   || aName == "int8")    return kPlyInt8;
+    if(aName == "uchar"  || aName == "uint8")   return kPlyUint8;
+    if(aName == "short"  || aName == "int16")   return kPlyInt16;
+    if(aName == "ushort" || aName == "uint16")  return kPlyUint16;
+    if(aName == "int"    || aName == "int32")   return kPlyInt32;
+    if(aName == "uint"   || aName == "uint32")  return kPlyUint32;
+    if(aName == "float"  || aName == "float32") return kPlyFloat32;
+    if(aName == "double" || aName == "float64") return kPlyFloat64;
+    return kPlyNone;
+  }
+
+  // Bytes of one binary value, ascii values take at least one character
+  inline int GetPlySize(PlyType aType)
+  {
+    switch(aType)
+    {
+    case kPlyInt8:    case kPlyUint8:   return 1;
+    case kPlyInt16:   case kPlyUint16:  return 2;
+    case kPlyInt32:   case kPlyUint32:  return 4;
+    case kPlyFloat32:                   return 4;
+    case kPlyFloat64:                   return 8;
+    default:                            return 1;
+    }
+  }
+
+  struct PlyProperty
+  {
+    PlyProperty() : mType(kPlyNone), mCountType(kPlyNone), mIsList(false)
+    {}
+
+    std::string mName;
+    PlyType     mType;
+    PlyType     mCountType; //!< Only for lists
+    bool        mIsList;
+  };
+
+  struct PlyElement
+  {
+    std::string              mName;
+    int                      mCount;
+    std::vector<PlyProperty> mProperties;
+  };
+
+  // Reads values of any PLY type as double from an ascii or binary stream
+  class PlyReader
+  {
+  public:
+
+    PlyReader(std::istream &aStream, bool aBinary, bool aSwapBytes) :
+      mStream(aStream),
+      mBinary(aBinary),
+      mSwapBytes(aSwapBytes)
+    {}
+
+    double Read(PlyType aType)
+    {
+      if(!mBinary)
+      {
+        double value = 0;
+        mStream >> value;
+        return value;
+      }
+
+      switch(aType)
+      {
+      case kPlyInt8:    return readBinary<signed char>();
+      case kPlyUint8:   return readBinary<unsigned char>();
+      case kPlyInt16:   return readBinary<short>();
+      case kPlyUint16:  return readBinary<unsigned short>();
+      case kPlyInt32:   return readBinary<int>();
+      case kPlyUint32:  return readBinary<unsigned int>();
+      case kPlyFloat32: return readBinary<float>();
+      case kPlyFloat64: return readBinary<double>();
+      default:
+        mStream.setstate(std::ios::failbit);
+        return 0;
+      }
+    }
+
+    bool Failed() const
+    {
+      return mStream.fail();
+    }
+
+  private:
+
+    template<typename T>
+    double readBinary()
+    {
+      T value;
+      char *bytes = reinterpret_cast<char*>(&value);
+      mStream.read(bytes, sizeof(T));
+
+      if(mSwapBytes)
+        std::reverse(bytes, bytes + sizeof(T));
+
+      return double(value);
+    }
+
+    std::istream &mStream;
+    bool         mBinary;
+    bool         mSwapBytes;
+  };
+
+  // Reads vertex x, y, z and face vertex_indices (or vertex_index),
+  // other elements and properties are skipped. PLY has no materials,
+  // everything gets the default one.
+  inline bool LoadPly(
+    const std::string &aFilename,
+    MeshData          &oMesh)
+  {
+    std::ifstream file(aFilename.c_str(), std::ios::binary);
+
+    if(!file)
+    {
+      printf("Cannot open %s\n", aFilename.c_str());
+      return false;
+    }
+
+    std::string line, format;
+    std::vector<PlyElement> elements;
+
+    std::getline(file, line);
+    StripCarriageReturn(line);
+
+    if(line.compare(0, 3, "ply") != 0)
+    {
+      printf("%s is not a PLY file\n", aFilename.c_str());
+      return false;
+    }
+
+    while(std::getline(file, line))
+    {
+      StripCarriageReturn(line);
+
+      std::istringstream iss(line);
+      std::string keyword;
+      iss >> keyword;
+
+      if(keyword == "format")
+        iss >> format;
+      else if(keyword == "element")
+      {
+        PlyElement element;
+        iss >> element.mName >> element.mCount;
+
+        if(iss.fail() || element.mCount < 0)
+        {
+          printf("%s: invalid element count in \"%s\"\n", aFilename.c_str(), line.c_str());
+          return false;
+        }
+
+        elements.push_back(element);
+      }
+      else if(keyword == "property" && !elements.empty())
+      {
+        PlyProperty property;
+        std::string type;
+        iss >> type;
+
+        if(type == "list")
+        {
+          std::string countType;
+          iss >> countType >> type;
+
+          property.mIsList    = true;
+          property.mCountType = GetPlyType(countType);
+        }
+
+        iss >> property.mName;
+        property.mType = GetPlyType(type);
+
+        if(property.mType == kPlyNone || (property.mIsList && property.mCountType == kPlyNone))
+        {
+          printf("%s: unknown PLY property type in \"%s\"\n", aFilename.c_str(), line.c_str());
+          return false;
+        }
+
+        elements.back().mProperties.push_back(property);
+      }
+      else if(keyword == "end_header")
+        break;
+    }
+
+    const bool binary = (format != "ascii");
+    const bool bigEndian = (format == "binary_big_endian");
+
+    if(binary && !bigEndian && format != "binary_little_endian")
+    {
+      printf("%s: unknown PLY format %s\n", aFilename.c_str(), format.c_str());
+      return false;
+    }
+
+    // Every item takes at least one byte per property (lists at least their
+    // count), so counts the rest of the file cannot hold are corrupt and
+    // must not get as far as reserve
+    const std::streamoff dataStart = file.tellg();
+    file.seekg(0, std::ios::end);
+    const std::streamoff dataEnd = file.tellg();
+    file.seekg(dataStart);
+
+    if(dataStart < 0 || dataEnd < dataStart)
+    {
+      printf("%s: cannot read PLY data\n", aFilename.c_str());
+      return false;
+    }
+
+    unsigned long long minDataSize = 0;
+    for(size_t e=0; e<elements.size(); e++)
+    {
+      const PlyElement &element = elements[e];
+      unsigned long long itemSize = 0;
+
+      for(size_t p=0; p<element.mProperties.size(); p++)
+      {
+        const PlyProperty &property = element.mProperties[p];
+        itemSize += binary ?
+          GetPlySize(property.mIsList ? property.mCountType : property.mType) : 1;
+      }
+
+      minDataSize += std::max(itemSize, 1ull) * (unsigned long long)element.mCount;
+
+      if(minDataSize > (unsigned long long)(dataEnd - dataStart))
+      {
+        printf("%s: element count %d of %s does not fit in the file\n", aFilename.c_str(),
+          element.mCount, element.mName.c_str());
+        return false;
+      }
+    }
+
+    const uint endianTest = 1;
+    const bool littleEndianMachine = *reinterpret_cast<const char*>(&endianTest) == 1;
+
+    PlyReader reader(file, binary, bigEndian == littleEndianMachine);
+    std::vector<uint> polygon;
+
+    oMesh.mMaterialList.push_back(MeshMaterial());
+    oMesh.mMaterialList.back().mName = "default";
+
+    for(size_t e=0; e<elements.size(); e++)
+    {
+      const PlyElement &element = elements[e];
+      const int numProperties = (int)element.mProperties.size();
+
+      if(element.mName == "vertex")
+        oMesh.mVertices.reserve(oMesh.mVertices.size() + element.mCount);
+
+      for(int i=0; i<element.mCount; i++)
+      {
+        float position[3] = { 0.f, 0.f, 0.f };
+        polygon.clear();
+
+        for(int p=0; p<numProperties; p++)
+        {
+          const PlyProperty &property = element.mProperties[p];
+
+          if(property.mIsList)
+          {
+            const double count = reader.Read(property.mCountType);
+            const bool isFace = element.mName == "face" &&
+              (property.mName == "vertex_indices" || property.mName == "vertex_index");
+
+            if(count < (isFace ? 3 : 0) || count > kPlyMaxListSize)
+            {
+              printf("%s: invalid list size %g in %s %d\n", aFilename.c_str(),
+                count, element.mName.c_str(), i);
+              return false;
+            }
+
+            for(int k=0; k<int(count); k++)
+            {
+              const double value = reader.Read(property.mType);
+
+              // Indices not representable as uint become out of range
+              if(isFace)
+                polygon.push_back(value >= 0 && value < 4294967295.0 ? uint(value) : uint(-1));
+            }
+          }
+          else
+          {
+            const double value = reader.Read(property.mType);
+
+            if(property.mName == "x") position[0] = float(value);
+            if(property.mName == "y") position[1] = float(value);
+            if(property.mName == "z") position[2] = float(value);
+          }
+        }
+
+        if(reader.Failed())
+        {
+          printf("%s: unexpected end of %s data\n", aFilename.c_str(), element.mName.c_str());
+          return false;
+        }
+
+        if(element.mName == "vertex")
+          oMesh.mVertices.push_back(ToZUp(position[0], position[1], position[2]));
+        else if(element.mName == "face")
+        {
+          for(size_t k=0; k<polygon.size(); k++)
+          {
+            if(polygon[k] >= oMesh.mVertices.size())
+            {
+              printf("%s: face %d references a missing vertex\n", aFilename.c_str(), i);
+              return false;
+            }
+          }
+
+          AddPolygon(polygon, 0, oMesh);
+        }
+      }
+    }
+
+    return true;
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // Picks the reader by extension, prints the reason on failure
+  inline bool Load(
+    const std::string &aFilename,
+    MeshData          &oMesh)
+  {
+    const std::string extension = GetExtension(aFilename);
+
+    if(extension == "obj")
+      return LoadObj(aFilename, oMesh);
+    if(extension == "ply")
+      return LoadPly(aFilename, oMesh);
+
+    printf("Unknown mesh format %s, use .obj or .ply\n", aFilename.c_str());
+    return false;
+  }
+}
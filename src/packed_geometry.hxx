@@ -0,0 +1,547 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include "math.hxx"
+#include "ray.hxx"
+#include "geometry.hxx"
+
+//////////////////////////////////////////////////////////////////////////
+// SIMD selection
+//
+// AVX packs 8 primitives, SSE 4. Without either (or with PG3_NO_SIMD)
+// packs hold 4 primitives and are intersected by the scalar loop.
+
+#if !defined(PG3_NO_SIMD)
+#   if defined(__AVX__)
+#       define PG3_SIMD_AVX
+#   elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#       define PG3_SIMD_SSE
+#   endif
+#endif
+
+#if defined(PG3_SIMD_AVX)
+#   include <immintrin.h>
+#   define PG3_PACK_WIDTH 8
+#elif defined(PG3_SIMD_SSE)
+#   include <emmintrin.h>
+#   define PG3_PACK_WIDTH 4
+#else
+#   define PG3_PACK_WIDTH 4
+#endif
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+// Index of the lowest set bit, aMask must not be 0
+inline int FirstSetBit(int aMask)
+{
+#if defined(_MSC_VER)
+  unsigned long idx;
+  _BitScanForward(&idx, (unsigned long)aMask);
+  return int(idx);
+#else
+  return __builtin_ctz((unsigned)aMask);
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Thin wrapper over the SIMD registers, just what the packed kernels need
+
+#if defined(PG3_SIMD_AVX)
+
+struct SimdFloat
+{
+  SimdFloat() {}
+  SimdFloat(__m256 a) : v(a) {}
+  SimdFloat(float a) : v(_mm256_set1_ps(a)) {}
+
+  static SimdFloat Load(const float *aPtr) { return _mm256_loadu_ps(aPtr); }
+
+  friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a.v, b.v); }
+  friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a.v, b.v); }
+  friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a.v, b.v); }
+  friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm256_div_ps(a.v, b.v); }
+  friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return _mm256_and_ps(a.v, b.v); }
+  friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return _mm256_or_ps(a.v, b.v); }
+  friend SimdFloat operator< (SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+  friend SimdFloat operator<=(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+  friend SimdFloat operator> (SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+  friend SimdFloat operator>=(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+  friend SimdFloat operator==(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+
+  friend SimdFloat Min (SimdFloat a, SimdFloat b) { return _mm256_min_ps(a.v, b.v); }
+  friend SimdFloat Max (SimdFloat a, SimdFloat b) { return _mm256_max_ps(a.v, b.v); }
+  friend SimdFloat Sqrt(SimdFloat a)              { return _mm256_sqrt_ps(a.v); }
+
+  // Per lane aMask ? a : b
+  friend SimdFloat Select(SimdFloat aMask, SimdFloat a, SimdFloat b)
+  { return _mm256_blendv_ps(b.v, a.v, aMask.v); }
+
+  friend int MoveMask(SimdFloat a) { return _mm256_movemask_ps(a.v); }
+
+  friend float HorizontalMin(SimdFloat a)
+  {
+    __m128 m = _mm_min_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+    m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(m);
+  }
+
+  __m256 v;
+};
+
+#elif defined(PG3_SIMD_SSE)
+
+struct SimdFloat
+{
+  SimdFloat() {}
+  SimdFloat(__m128 a) : v(a) {}
+  SimdFloat(float a) : v(_mm_set1_ps(a)) {}
+
+  static SimdFloat Load(const float *aPtr) { return _mm_loadu_ps(aPtr); }
+
+  friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm_add_ps(a.v, b.v); }
+  friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a.v, b.v); }
+  friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a.v, b.v); }
+  friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm_div_ps(a.v, b.v); }
+  friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return _mm_and_ps(a.v, b.v); }
+  friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return _mm_or_ps(a.v, b.v); }
+  friend SimdFloat operator< (SimdFloat a, SimdFloat b) { return _mm_cmplt_ps(a.v, b.v); }
+  friend SimdFloat operator<=(SimdFloat a, SimdFloat b) { return _mm_cmple_ps(a.v, b.v); }
+  friend SimdFloat operator> (SimdFloat a, SimdFloat b) { return _mm_cmpgt_ps(a.v, b.v); }
+  friend SimdFloat operator>=(SimdFloat a, SimdFloat b) { return _mm_cmpge_ps(a.v, b.v); }
+  friend SimdFloat operator==(SimdFloat a, SimdFloat b) { return _mm_cmpeq_ps(a.v, b.v); }
+
+  friend SimdFloat Min (SimdFloat a, SimdFloat b) { return _mm_min_ps(a.v, b.v); }
+  friend SimdFloat Max (SimdFloat a, SimdFloat b) { return _mm_max_ps(a.v, b.v); }
+  friend SimdFloat Sqrt(SimdFloat a)              { return _mm_sqrt_ps(a.v); }
+
+  // Per lane aMask ? a : b, SSE2 has no blend
+  friend SimdFloat Select(SimdFloat aMask, SimdFloat a, SimdFloat b)
+  { return _mm_or_ps(_mm_and_ps(aMask.v, a.v), _mm_andnot_ps(aMask.v, b.v)); }
+
+  friend int MoveMask(SimdFloat a) { return _mm_movemask_ps(a.v); }
+
+  friend float HorizontalMin(SimdFloat a)
+  {
+    __m128 m = _mm_min_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 3, 0, 1)));
+    m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(m);
+  }
+
+  __m128 v;
+};
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Packed triangles
+//
+// Up to PG3_PACK_WIDTH triangles in structure of arrays layout, all of
+// them are tested at once (Moller-Trumbore). Same semantics as Triangle:
+// back faces are culled and the hit normal is the geometric normal.
+// Unused lanes hold degenerate triangles which never hit.
+
+class TrianglePack : public AbstractGeometry
+{
+public:
+
+  enum { kWidth = PG3_PACK_WIDTH };
+
+  TrianglePack() : mCount(0)
+  {
+    for(int i=0; i<kWidth; i++)
+      setLane(i, Vec3f(0), Vec3f(0), Vec3f(0), Vec3f(0, 0, 1), -1);
+  }
+
+  // Returns false when the pack is already full
+  bool Add(const Triangle &aTriangle)
+  {
+    if(mCount == kWidth)
+      return false;
+
+    setLane(mCount, aTriangle.p[0], aTriangle.p[1] - aTriangle.p[0],
+      aTriangle.p[2] - aTriangle.p[0], aTriangle.mNormal, aTriangle.matID);
+    mCount++;
+    return true;
+  }
+
+  int GetCount() const
+  {
+    return mCount;
+  }
+
+  virtual bool Intersect(
+    const Ray &aRay,
+    Isect     &oResult) const
+  {
+#if defined(PG3_SIMD_AVX) || defined(PG3_SIMD_SSE)
+    return IntersectSimd(aRay, oResult);
+#else
+    return IntersectScalar(aRay, oResult);
+#endif
+  }
+
+  bool IntersectScalar(
+    const Ray &aRay,
+    Isect     &oResult) const
+  {
+    int hitLane = -1;
+
+    for(int i=0; i<mCount; i++)
+    {
+      // pvec = dir x e2
+      const float px = aRay.dir.y * mE2z[i] - aRay.dir.z * mE2y[i];
+      const float py = aRay.dir.z * mE2x[i] - aRay.dir.x * mE2z[i];
+      const float pz = aRay.dir.x * mE2y[i] - aRay.dir.y * mE2x[i];
+
+      const float det = mE1x[i] * px + mE1y[i] * py + mE1z[i] * pz;
+
+      // Back faces have det < 0, parallel rays det == 0
+      if(!(det > 0.f))
+        continue;
+
+      const float tx = aRay.org.x - mP0x[i];
+      const float ty = aRay.org.y - mP0y[i];
+      const float tz = aRay.org.z - mP0z[i];
+
+      const float u = tx * px + ty * py + tz * pz;
+      if(u < 0.f || u > det)
+        continue;
+
+      // qvec = tvec x e1
+      const float qx = ty * mE1z[i] - tz * mE1y[i];
+      const float qy = tz * mE1x[i] - tx * mE1z[i];
+      const float qz = tx * mE1y[i] - ty * mE1x[i];
+
+      const float v = aRay.dir.x * qx + aRay.dir.y * qy + aRay.dir.z * qz;
+      if(v < 0.f || u + v > det)
+        continue;
+
+      const float t = (mE2x[i] * qx + mE2y[i] * qy + mE2z[i] * qz) / det;
+
+      if((t > aRay.tmin) & (t < oResult.dist))
+      {
+        oResult.dist = t;
+        hitLane = i;
+      }
+    }
+
+    if(hitLane < 0)
+      return false;
+
+    setResult(hitLane, oResult);
+    return true;
+  }
+
+#if defined(PG3_SIMD_AVX) || defined(PG3_SIMD_SSE)
+  bool IntersectSimd(
+    const Ray &aRay,
+    Isect     &oResult) const
+  {
+    const SimdFloat dx(aRay.dir.x), dy(aRay.dir.y), dz(aRay.dir.z);
+
+    const SimdFloat e1x = SimdFloat::Load(mE1x);
+    const SimdFloat e1y = SimdFloat::Load(mE1y);
+    const SimdFloat e1z = SimdFloat::Load(mE1z);
+    const SimdFloat e2x = SimdFloat::Load(mE2x);
+    const SimdFloat e2y = SimdFloat::Load(mE2y);
+    const SimdFloat e2z = SimdFloat::Load(mE2z);
+
+    const SimdFloat px = dy * e2z - dz * e2y;
+    const SimdFloat py = dz * e2x - dx * e2z;
+    const SimdFloat pz = dx * e2y - dy * e2x;
+
+    const SimdFloat det = e1x * px + e1y * py + e1z * pz;
+
+    const SimdFloat tx = SimdFloat(aRay.org.x) - SimdFloat::Load(mP0x);
+    const SimdFloat ty = SimdFloat(aRay.org.y) - SimdFloat::Load(mP0y);
+    const SimdFloat tz = SimdFloat(aRay.org.z) - SimdFloat::Load(mP0z);
+
+    const SimdFloat u = tx * px + ty * py + tz * pz;
+
+    const SimdFloat qx = ty * e1z - tz * e1y;
+    const SimdFloat qy = tz * e1x - tx * e1z;
+    const SimdFloat qz = tx * e1y - ty * e1x;
+
+    const SimdFloat v = dx * qx + dy * qy + dz * qz;
+    const SimdFloat t = (e2x * qx + e2y * qy + e2z * qz) / det;
+
+    const SimdFloat zero(0.f);
+    const SimdFloat mask =
+      (det > zero) & (u >= zero) & (v >= zero) & ((u + v) <= det) &
+      (t > SimdFloat(aRay.tmin)) & (t < SimdFloat(oResult.dist));
+
+    if(MoveMask(mask) == 0)
+      return false;
+
+    const SimdFloat tHit   = Select(mask, t, SimdFloat(INFTY_F));
+    const float     minT   = HorizontalMin(tHit);
+    const int       lane   = FirstSetBit(MoveMask(mask & (tHit == SimdFloat(minT))));
+
+    oResult.dist = minT;
+    setResult(lane, oResult);
+    return true;
+  }
+#endif
+
+  virtual void GrowBBox(
+    Vec3f &aoBBoxMin,
+    Vec3f &aoBBoxMax)
+  {
+    for(int i=0; i<mCount; i++)
+    {
+      const Vec3f p0(mP0x[i], mP0y[i], mP0z[i]);
+      const Vec3f p[3] = {
+        p0,
+        p0 + Vec3f(mE1x[i], mE1y[i], mE1z[i]),
+        p0 + Vec3f(mE2x[i], mE2y[i], mE2z[i])
+      };
+
+      for(int k=0; k<3; k++)
+      {
+        for(int j=0; j<3; j++)
+        {
+          aoBBoxMin.Get(j) = std::min(aoBBoxMin.Get(j), p[k].Get(j));
+          aoBBoxMax.Get(j) = std::max(aoBBoxMax.Get(j), p[k].Get(j));
+        }
+      }
+    }
+  }
+
+private:
+
+  void setLane(
+    int          aLane,
+    const Vec3f &aP0,
+    const Vec3f &aE1,
+    const Vec3f &aE2,
+    const Vec3f &aNormal,
+    int          aMatID)
+  {
+    mP0x[aLane] = aP0.x; mP0y[aLane] = aP0.y; mP0z[aLane] = aP0.z;
+    mE1x[aLane] = aE1.x; mE1y[aLane] = aE1.y; mE1z[aLane] = aE1.z;
+    mE2x[aLane] = aE2.x; mE2y[aLane] = aE2.y; mE2z[aLane] = aE2.z;
+    mNx [aLane] = aNormal.x; mNy[aLane] = aNormal.y; mNz[aLane] = aNormal.z;
+    mMatID[aLane] = aMatID;
+  }
+
+  void setResult(int aLane, Isect &oResult) const
+  {
+    oResult.normal = Vec3f(mNx[aLane], mNy[aLane], mNz[aLane]);
+    oResult.matID  = mMatID[aLane];
+  }
+
+  float mP0x[kWidth], mP0y[kWidth], mP0z[kWidth];
+  float mE1x[kWidth], mE1y[kWidth], mE1z[kWidth];
+  float mE2x[kWidth], mE2y[kWidth], mE2z[kWidth];
+  float mNx [kWidth], mNy [kWidth], mNz [kWidth];
+  int   mMatID[kWidth];
+  int   mCount;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Packed spheres
+//
+// Same as TrianglePack, for spheres. Uses the geometric form of the
+// discriminant, which is precise enough in single precision.
+// Unused lanes hold spheres with negative squared radius, these never hit.
+
+class SpherePack : public AbstractGeometry
+{
+public:
+
+  enum { kWidth = PG3_PACK_WIDTH };
+
+  SpherePack() : mCount(0)
+  {
+    for(int i=0; i<kWidth; i++)
+      setLane(i, Vec3f(0), -1.f, -1);
+  }
+
+  // For a ray starting on or near the sphere, |org - center|^2 - radius^2
+  // cancels and the float hit distance is off by about FLT_EPSILON * radius,
+  // more for grazing rays. That has to stay well below the absolute ray
+  // offset EPS_RAY, which sets the scene units, or rays re-hit the surface
+  // they leave. The margin of 4096 allows radius 2 with EPS_RAY 1e-3, the
+  // Cornell box spheres are 0.5. Larger spheres, e.g. walls made of huge
+  // spheres, stay with Sphere, which does the root finding in double.
+  static bool CanPack(const Sphere &aSphere)
+  {
+    return aSphere.radius * FLT_EPSILON * 4096.f <= EPS_RAY;
+  }
+
+  // Returns false when the pack is already full
+  bool Add(const Sphere &aSphere)
+  {
+    if(mCount == kWidth)
+      return false;
+
+    setLane(mCount, aSphere.center, Sqr(aSphere.radius), aSphere.matID);
+    mCount++;
+    return true;
+  }
+
+  int GetCount() const
+  {
+    return mCount;
+  }
+
+  virtual bool Intersect(
+    const Ray &aRay,
+    Isect     &oResult) const
+  {
+#if defined(PG3_SIMD_AVX) || defined(PG3_SIMD_SSE)
+    return IntersectSimd(aRay, oResult);
+#else
+    return IntersectScalar(aRay, oResult);
+#endif
+  }
+
+  bool IntersectScalar(
+    const Ray &aRay,
+    Isect     &oResult) const
+  {
+    const float A    = Dot(aRay.dir, aRay.dir);
+    const float invA = 1.f / A;
+    int hitLane = -1;
+
+    for(int i=0; i<mCount; i++)
+    {
+      const Vec3f oc = aRay.org - Vec3f(mCx[i], mCy[i], mCz[i]);
+      const float b  = Dot(oc, aRay.dir);
+      const float c  = Dot(oc, oc) - mRadiusSqr[i];
+
+      // Distance of the center from the ray line
+      const Vec3f f  = oc - aRay.dir * Vec3f(b * invA);
+      const float h  = A * (mRadiusSqr[i] - Dot(f, f));
+
+      if(h < 0.f)
+        continue;
+
+      const float s = std::sqrt(h);
+      const float q = (b < 0.f) ? (s - b) : (-b - s);
+
+      float t0 = q * invA;
+      float t1 = c / q;
+      if(t0 > t1) std::swap(t0, t1);
+
+      if(t0 > aRay.tmin && t0 < oResult.dist)
+        oResult.dist = t0;
+      else if(t1 > aRay.tmin && t1 < oResult.dist)
+        oResult.dist = t1;
+      else
+        continue;
+
+      hitLane = i;
+    }
+
+    if(hitLane < 0)
+      return false;
+
+    setResult(hitLane, aRay, oResult);
+    return true;
+  }
+
+#if defined(PG3_SIMD_AVX) || defined(PG3_SIMD_SSE)
+  bool IntersectSimd(
+    const Ray &aRay,
+    Isect     &oResult) const
+  {
+    const SimdFloat dx(aRay.dir.x), dy(aRay.dir.y), dz(aRay.dir.z);
+    const float A = Dot(aRay.dir, aRay.dir);
+    const SimdFloat simdA(A);
+    const SimdFloat invA(1.f / A);
+
+    const SimdFloat ocx = SimdFloat(aRay.org.x) - SimdFloat::Load(mCx);
+    const SimdFloat ocy = SimdFloat(aRay.org.y) - SimdFloat::Load(mCy);
+    const SimdFloat ocz = SimdFloat(aRay.org.z) - SimdFloat::Load(mCz);
+    const SimdFloat r2  = SimdFloat::Load(mRadiusSqr);
+
+    const SimdFloat b = ocx * dx + ocy * dy + ocz * dz;
+    const SimdFloat c = ocx * ocx + ocy * ocy + ocz * ocz - r2;
+
+    const SimdFloat bOverA = b * invA;
+    const SimdFloat fx = ocx - dx * bOverA;
+    const SimdFloat fy = ocy - dy * bOverA;
+    const SimdFloat fz = ocz - dz * bOverA;
+    const SimdFloat h  = simdA * (r2 - (fx * fx + fy * fy + fz * fz));
+
+    const SimdFloat zero(0.f);
+    const SimdFloat discMask = (h >= zero) & (r2 >= zero);
+
+    if(MoveMask(discMask) == 0)
+      return false;
+
+    const SimdFloat s  = Sqrt(Max(h, zero));
+    const SimdFloat q  = Select(b < zero, s - b, zero - b - s);
+    const SimdFloat ta = q * invA;
+    const SimdFloat tb = c / q;
+    const SimdFloat t0 = Min(ta, tb);
+    const SimdFloat t1 = Max(ta, tb);
+
+    const SimdFloat tMin(aRay.tmin);
+    const SimdFloat tMax(oResult.dist);
+    const SimdFloat t0Mask = (t0 > tMin) & (t0 < tMax);
+    const SimdFloat t1Mask = (t1 > tMin) & (t1 < tMax);
+    const SimdFloat mask   = discMask & (t0Mask | t1Mask);
+
+    if(MoveMask(mask) == 0)
+      return false;
+
+    const SimdFloat tHit = Select(mask, Select(t0Mask, t0, t1), SimdFloat(INFTY_F));
+    const float     minT = HorizontalMin(tHit);
+    const int       lane = FirstSetBit(MoveMask(mask & (tHit == SimdFloat(minT))));
+
+    oResult.dist = minT;
+    setResult(lane, aRay, oResult);
+    return true;
+  }
+#endif
+
+  virtual void GrowBBox(
+    Vec3f &aoBBoxMin,
+    Vec3f &aoBBoxMax)
+  {
+    for(int i=0; i<mCount; i++)
+    {
+      const float radius = std::sqrt(mRadiusSqr[i]);
+
+      aoBBoxMin.x = std::min(aoBBoxMin.x, mCx[i] - radius);
+      aoBBoxMin.y = std::min(aoBBoxMin.y, mCy[i] - radius);
+      aoBBoxMin.z = std::min(aoBBoxMin.z, mCz[i] - radius);
+      aoBBoxMax.x = std::max(aoBBoxMax.x, mCx[i] + radius);
+      aoBBoxMax.y = std::max(aoBBoxMax.y, mCy[i] + radius);
+      aoBBoxMax.z = std::max(aoBBoxMax.z, mCz[i] + radius);
+    }
+  }
+
+private:
+
+  void setLane(
+    int          aLane,
+    const Vec3f &aCenter,
+    float        aRadiusSqr,
+    int          aMatID)
+  {
+    mCx[aLane] = aCenter.x; mCy[aLane] = aCenter.y; mCz[aLane] = aCenter.z;
+    mRadiusSqr[aLane] = aRadiusSqr;
+    mMatID[aLane]     = aMatID;
+  }
+
+  void setResult(int aLane, const Ray &aRay, Isect &oResult) const
+  {
+    const Vec3f oc = aRay.org - Vec3f(mCx[aLane], mCy[aLane], mCz[aLane]);
+    oResult.matID  = mMatID[aLane];
+    oResult.normal = Normalize(oc + Vec3f(oResult.dist) * aRay.dir);
+  }
+
+  float mCx[kWidth], mCy[kWidth], mCz[kWidth];
+  float mRadiusSqr[kWidth];
+  int   mMatID[kWidth];
+  int   mCount;
+};
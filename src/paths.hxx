@@ -35,6 +35,7 @@ struct LightNode
 
   LightNode(Rng& rng, const Scene &scene, int lightID)
   {
+    STATS_COUNT(kStatLightPaths);
     this->light = scene.GetLightPtr(lightID);
     this->ray = this->light->generateRay(rng, &this->pdfA, &this->pdfW);
     this->cosW1 = this->light->getCosGamma(ray.dir);
@@ -22,7 +22,7 @@ public:
     const Scene& aScene,
     int aSeed = 1234
     ) :
-  AbstractRenderer(aScene), mRng(aSeed)
+  AbstractRenderer(aScene, aSeed)
   {}
 
   struct SceneHitState
@@ -54,46 +54,57 @@ public:
 protected:
   Vec3f sampleLight(SceneHitState& state, int lightID)
   {
-    Vec3f LoDirect(0);
+    float lightDist;
+    Vec3f wig;
+    const Vec3f illum = sampleLightUnoccluded(state, lightID, wig, lightDist);
+
+    if(illum.Max() > 0)
+    {
+      if( ! mScene.Occluded(state.surfPt, wig, lightDist) )
+        return illum;
+    }
+
+    return Vec3f(0);
+  }
 
+  // First half of sampleLight, leaves the shadow ray (oWig, oLightDist) to the caller
+  Vec3f sampleLightUnoccluded(SceneHitState& state, int lightID, Vec3f& oWig, float& oLightDist)
+  {
     const AbstractLight* light = mScene.GetLightPtr(lightID);
     state.light = light;
     if (light == NULL)
     {
       state.pdfLight = 1;
-      return LoDirect;
+      return Vec3f(0);
     }
 
-    float lightDist;
-    Vec3f illum(0);
-    Vec3f wig;
     float pdf = 0;
+    Vec3f illum = light->sampleIllumination(mRng, state.surfPt, state.frame, oWig, oLightDist, pdf);
 
-    illum = light->sampleIllumination(mRng, state.surfPt, state.frame, wig, lightDist, pdf);
-
-    if(illum.Max() > 0)
-    {
-      if( ! mScene.Occluded(state.surfPt, wig, lightDist) )
-        LoDirect += illum;
-    }
-
-    state.pdfBrdf = state.mat->getPdf(state.frame.ToLocal(wig), state.wol);
-    state.pdfBrdf = light->transformPdfToLight(state.pdfBrdf, wig, lightDist);
+    state.pdfBrdf = state.mat->getPdf(state.frame.ToLocal(oWig), state.wol);
+    state.pdfBrdf = light->transformPdfToLight(state.pdfBrdf, oWig, oLightDist);
 
     state.pdfLight = pdf;
-    state.sampledRay.dir = wig;
-    return LoDirect;
+    state.sampledRay.dir = oWig;
+    return illum;
   }
 
   Vec3f sampleDirection(SceneHitState& state, bool withoutCos = false)
   {
+    Isect lightIsect;
+    lightIsect.matID = -1;
 
+    const bool hit = mScene.Intersect(state.sampledRay, lightIsect);
+    return evalSampledDirection(state, hit, lightIsect, withoutCos);
+  }
+
+  // Second half of sampleDirection, for rays which were already intersected
+  Vec3f evalSampledDirection(SceneHitState& state, bool hit, const Isect& lightIsect, bool withoutCos = false)
+  {
     Vec3f LoDirect(0);
-    Isect lightIsect;
     const AbstractLight* light = NULL;
-    lightIsect.matID = -1;
 
-    if(mScene.Intersect(state.sampledRay, lightIsect))
+    if(hit)
     {
       if (lightIsect.lightID >= 0)
       {
@@ -127,9 +138,6 @@ protected:
       cosThetaOut = 1.f;
     return LoDirect * cosThetaOut;
   }
-
-public:
-  Rng              mRng;
 };
 
 #endif // PATHTRACER_HXX_
\ No newline at end of file
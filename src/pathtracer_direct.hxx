@@ -15,17 +15,26 @@ public:
   PathTracer(aScene, aSeed)
   {}
 
-  virtual void RunIteration(int aIteration)
+  virtual void RunTile(
+    const Tile  &aTile,
+    int         aIteration,
+    Framebuffer &oFramebuffer)
   {
-    const int resX = int(mScene.mCamera.mResolution.x);
-    const int resY = int(mScene.mCamera.mResolution.y);
+    const int resX     = int(mScene.mCamera.mResolution.x);
+    const int tileResX = aTile.mX1 - aTile.mX0;
+    const int tileResY = aTile.mY1 - aTile.mY0;
 
-    for(int pixID = 0; pixID < resX * resY; pixID++)
+    for(int pixID = 0; pixID < tileResX * tileResY; pixID++)
     {
       //////////////////////////////////////////////////////////////////////////
       // Generate ray
-      const int x = pixID % resX;
-      const int y = pixID / resX;
+      const int x = aTile.mX0 + pixID % tileResX;
+      const int y = aTile.mY0 + pixID / tileResX;
+
+      if(!oFramebuffer.IsActive(x, y))
+        continue;
+
+      mRng.StartSample(uint(x + y * resX), uint(aIteration));
 
       const Vec2f sample = Vec2f(float(x), float(y)) + mRng.GetVec2f();
 
@@ -101,10 +110,8 @@ public:
 #endif
         }
 
-        mFramebuffer.AddColor(sample, LoDirect);
+        oFramebuffer.AddColor(sample, LoDirect);
       }
     }
-
-    mIterations++;
   }
 };
\ No newline at end of file
@@ -0,0 +1,398 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include "pathtracer.hxx"
+#include "scheduler.hxx"
+
+// Wavefront variant of PathTracerGlobal. Instead of following one path at
+// a time, all paths of a tile are kept in structure of arrays queues and
+// advanced stage by stage: camera rays, roulette, light samples with one
+// batch of shadow rays, BRDF samples, one batch of extension rays and
+// shading. The estimator is the same as PathTracerGlobal::pathForwardMIS,
+// only the order in which random numbers are drawn differs.
+class PathTracerWavefront : public PathTracer
+{
+public:
+  PathTracerWavefront(
+    const Scene& aScene,
+    int aSeed = 1234
+    ) :
+  PathTracer(aScene, aSeed),
+    mIteration(0)
+  {}
+
+  virtual void RunTile(
+    const Tile  &aTile,
+    int         aIteration,
+    Framebuffer &oFramebuffer)
+  {
+    const int resX     = int(mScene.mCamera.mResolution.x);
+    const int tileResX = aTile.mX1 - aTile.mX0;
+    const int tileResY = aTile.mY1 - aTile.mY0;
+
+    mPaths.Resize(tileResX * tileResY);
+    mAlive.resize(tileResX * tileResY);
+    mIteration = aIteration;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Generate and extend camera rays
+    int count = 0;
+
+    for(int pixID = 0; pixID < tileResX * tileResY; pixID++)
+    {
+      const int x = aTile.mX0 + pixID % tileResX;
+      const int y = aTile.mY0 + pixID / tileResX;
+
+      // Converged pixels get no paths in adaptive sampling
+      if(!oFramebuffer.IsActive(x, y))
+        continue;
+
+      mPaths.pixel[count] = uint(x + y * resX);
+      resumeSample(count, 0);
+
+      mPaths.sample[count] = Vec2f(float(x), float(y)) + mRng.GetVec2f();
+      mPaths.ray[count]    = mScene.mCamera.GenerateRay(mPaths.sample[count]);
+
+      suspendSample(count);
+      count++;
+    }
+
+    extendRays(count);
+
+    // Directly visible lights end the path, everything else starts one
+    for(int i=0; i<count; i++)
+    {
+      mPaths.radiance[i] = Vec3f(0.f);
+      mAlive[i] = false;
+
+      if(!mPaths.hit[i])
+        continue;
+
+      const Isect &isect = mPaths.isect[i];
+
+      if(isect.lightID >= 0 &&
+        mScene.GetLightPtr(isect.lightID)->getCosGamma(-mPaths.ray[i].dir) > EPS_COSINE)
+      {
+        mPaths.radiance[i] = mScene.GetLightPtr(isect.lightID)->getRadiance();
+        continue;
+      }
+
+      mPaths.throughput[i] = Vec3f(1.f);
+      setVertex(i);
+      mAlive[i] = true;
+    }
+
+    count = compact(count, oFramebuffer);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Bounce loop, every stage runs over all active paths
+    while(count > 0)
+    {
+      russianRoulette(count);
+      count = compact(count, oFramebuffer);
+
+      sampleLights(count);
+      traceShadowRays();
+
+      sampleBrdfs(count);
+      extendRays(count);
+      shadeHits(count);
+      count = compact(count, oFramebuffer);
+    }
+  }
+
+private:
+
+  // All active paths, one entry per path in every array
+  struct PathQueue
+  {
+    std::vector<Vec2f> sample;      //!< Raster position, identifies the pixel
+    std::vector<uint>  pixel;       //!< Pixel index, keys the sampler
+    std::vector<uint>  dimension;   //!< Next sampler dimension of the path
+    std::vector<Vec3f> throughput;  //!< Path weight up to the current vertex
+    std::vector<Vec3f> radiance;    //!< Radiance gathered so far
+    std::vector<Vec3f> surfPt;      //!< Current vertex
+    std::vector<const Material*> mat;
+    std::vector<Frame> frame;
+    std::vector<Vec3f> wol;
+    std::vector<Isect> isect;       //!< Intersection which created the vertex
+    std::vector<Ray>   ray;         //!< Camera or BRDF sampled extension ray
+    std::vector<Vec3f> brdf;
+    std::vector<float> pdf;
+    std::vector<char>  isMirror;
+    std::vector<char>  hit;         //!< Whether the extension ray hit anything
+
+    void Resize(int aSize)
+    {
+      sample.resize(aSize);
+      pixel.resize(aSize);
+      dimension.resize(aSize);
+      throughput.resize(aSize);
+      radiance.resize(aSize);
+      surfPt.resize(aSize);
+      mat.resize(aSize);
+      frame.resize(aSize);
+      wol.resize(aSize);
+      isect.resize(aSize);
+      ray.resize(aSize);
+      brdf.resize(aSize);
+      pdf.resize(aSize);
+      isMirror.resize(aSize);
+      hit.resize(aSize);
+    }
+
+    // Moves entry aFrom to aTo, used for compaction
+    void Move(int aFrom, int aTo)
+    {
+      sample[aTo]     = sample[aFrom];
+      pixel[aTo]      = pixel[aFrom];
+      dimension[aTo]  = dimension[aFrom];
+      throughput[aTo] = throughput[aFrom];
+      radiance[aTo]   = radiance[aFrom];
+      surfPt[aTo]     = surfPt[aFrom];
+      mat[aTo]        = mat[aFrom];
+      frame[aTo]      = frame[aFrom];
+      wol[aTo]        = wol[aFrom];
+      isect[aTo]      = isect[aFrom];
+      ray[aTo]        = ray[aFrom];
+      brdf[aTo]       = brdf[aFrom];
+      pdf[aTo]        = pdf[aFrom];
+      isMirror[aTo]   = isMirror[aFrom];
+      hit[aTo]        = hit[aFrom];
+    }
+  };
+
+  // Shadow rays of one light sampling stage
+  struct ShadowQueue
+  {
+    std::vector<int>   pathIdx;
+    std::vector<Vec3f> org;
+    std::vector<Vec3f> dir;
+    std::vector<float> dist;
+    std::vector<Vec3f> contribution; //!< Added to the path when unoccluded
+
+    void Clear()
+    {
+      pathIdx.clear();
+      org.clear();
+      dir.clear();
+      dist.clear();
+      contribution.clear();
+    }
+  };
+
+  // Paths advance stage by stage, so the sampler has to be switched to
+  // the sample of the path before drawing numbers for it and the reached
+  // dimension has to be remembered afterwards
+  void resumeSample(int aIdx, uint aDimension)
+  {
+    mRng.StartSample(mPaths.pixel[aIdx], uint(mIteration), aDimension);
+  }
+
+  void resumeSample(int aIdx)
+  {
+    resumeSample(aIdx, mPaths.dimension[aIdx]);
+  }
+
+  void suspendSample(int aIdx)
+  {
+    mPaths.dimension[aIdx] = mRng.GetDimension();
+  }
+
+  // Fills the vertex of path aIdx from its ray and isect
+  void setVertex(int aIdx)
+  {
+    const Ray &ray = mPaths.ray[aIdx];
+
+    mPaths.surfPt[aIdx] = ray.org + ray.dir * mPaths.isect[aIdx].dist;
+    mPaths.mat[aIdx]    = &mScene.GetMaterial(mPaths.isect[aIdx].matID);
+    mPaths.frame[aIdx].SetFromZ(mPaths.isect[aIdx].normal);
+    mPaths.wol[aIdx] = mPaths.frame[aIdx].ToLocal(-ray.dir);
+  }
+
+  // SceneHitState of path aIdx, as pathForwardMIS would see it
+  SceneHitState getHitState(int aIdx) const
+  {
+    SceneHitState state(*mPaths.mat[aIdx]);
+    state.surfPt = mPaths.surfPt[aIdx];
+    state.frame  = mPaths.frame[aIdx];
+    state.wol    = mPaths.wol[aIdx];
+    state.isect  = mPaths.isect[aIdx];
+    return state;
+  }
+
+  float getReflectance(int aIdx) const
+  {
+    const Material &mat = *mPaths.mat[aIdx];
+    return std::min(1.f, mat.mDiffuseReflectance.Max() + mat.mPhongReflectance.Max());
+  }
+
+  void russianRoulette(int aCount)
+  {
+    for(int i=0; i<aCount; i++)
+    {
+      const float reflectance = getReflectance(i);
+
+      resumeSample(i);
+      const float roulette = mRng.GetFloat();
+      suspendSample(i);
+
+      if(roulette > reflectance)
+      {
+        mAlive[i] = false;
+        continue;
+      }
+
+      mPaths.throughput[i] = mPaths.throughput[i] * Vec3f(1.f / reflectance);
+    }
+  }
+
+  // Creates one shadow ray per path and light, unoccluded contribution
+  // is computed right away so the shadow stage only adds it up
+  void sampleLights(int aCount)
+  {
+    mShadows.Clear();
+
+    for(int i=0; i<aCount; i++)
+    {
+      SceneHitState state = getHitState(i);
+      resumeSample(i);
+
+      for(int l=0; l<mScene.GetLightCount(); l++)
+      {
+        Vec3f wig;
+        float lightDist;
+        const Vec3f illum = sampleLightUnoccluded(state, l, wig, lightDist);
+
+        if(!(illum.Max() > 0))
+          continue;
+
+        const float weight = state.pdfLight / (state.pdfLight + state.pdfBrdf);
+        const Vec3f contribution = mPaths.throughput[i] * illum *
+          state.mat->evalBrdf(state.frame.ToLocal(wig), state.wol) *
+          (1.f / state.pdfLight) * weight;
+
+        mShadows.pathIdx.push_back(i);
+        mShadows.org.push_back(state.surfPt);
+        mShadows.dir.push_back(wig);
+        mShadows.dist.push_back(lightDist);
+        mShadows.contribution.push_back(contribution);
+      }
+
+      suspendSample(i);
+    }
+  }
+
+  void traceShadowRays()
+  {
+    for(int s=0; s<(int)mShadows.pathIdx.size(); s++)
+    {
+      if(!mScene.Occluded(mShadows.org[s], mShadows.dir[s], mShadows.dist[s]))
+      {
+        const int i = mShadows.pathIdx[s];
+        mPaths.radiance[i] += mShadows.contribution[s];
+      }
+    }
+  }
+
+  void sampleBrdfs(int aCount)
+  {
+    for(int i=0; i<aCount; i++)
+    {
+      const Material &mat = *mPaths.mat[i];
+
+      resumeSample(i);
+      const Vec2f randomVec = mRng.GetVec2f();
+
+      float pdf = 0;
+      Vec3f brdf(0);
+      const Vec3f sampleHemisphere =
+        mat.sampleBrdfHemisphere(randomVec, &pdf, &brdf, mPaths.wol[i], mRng);
+      suspendSample(i);
+
+      mPaths.ray[i]      = Ray(mPaths.surfPt[i], mPaths.frame[i].ToWorld(sampleHemisphere), EPS_RAY);
+      mPaths.brdf[i]     = brdf;
+      mPaths.pdf[i]      = pdf;
+      mPaths.isMirror[i] = mat.isMirror();
+    }
+  }
+
+  void extendRays(int aCount)
+  {
+    for(int i=0; i<aCount; i++)
+    {
+      Isect isect;
+      isect.matID = -1;
+      mPaths.hit[i]   = mScene.Intersect(mPaths.ray[i], isect);
+      mPaths.isect[i] = isect;
+    }
+  }
+
+  // Adds light hit by the extension ray (MIS weighted) and ends such
+  // paths, the others move on to the new vertex
+  void shadeHits(int aCount)
+  {
+    for(int i=0; i<aCount; i++)
+    {
+      SceneHitState state(*mPaths.mat[i]);
+      state.frame      = mPaths.frame[i];
+      state.sampledRay = mPaths.ray[i];
+
+      const bool  isMirror = mPaths.isMirror[i] != 0;
+      const Vec3f illum    = evalSampledDirection(state, mPaths.hit[i] != 0, mPaths.isect[i], isMirror);
+      const float pdf      = mPaths.pdf[i];
+      const Vec3f weighted = mPaths.throughput[i] * mPaths.brdf[i] * Vec3f(1.f / pdf);
+
+      if(state.light != NULL)
+      {
+        const float weight = isMirror ? 1.f : pdf / (state.pdfLight + pdf);
+        mPaths.radiance[i] += illum * weighted * Vec3f(weight);
+        mAlive[i] = false;
+        continue;
+      }
+
+      // Escaped into a scene without any light
+      if(!mPaths.hit[i])
+      {
+        mAlive[i] = false;
+        continue;
+      }
+
+      const float cosThetaOut = isMirror ? 1.f : Dot(mPaths.frame[i].mZ, mPaths.ray[i].dir);
+      mPaths.throughput[i] = weighted * Vec3f(cosThetaOut);
+      setVertex(i);
+    }
+  }
+
+  // Removes finished paths, their radiance goes to the framebuffer.
+  // Returns the number of remaining paths.
+  int compact(
+    int         aCount,
+    Framebuffer &oFramebuffer)
+  {
+    int alive = 0;
+
+    for(int i=0; i<aCount; i++)
+    {
+      if(!mAlive[i])
+      {
+        oFramebuffer.AddColor(mPaths.sample[i], mPaths.radiance[i]);
+        continue;
+      }
+
+      if(alive != i)
+        mPaths.Move(i, alive);
+
+      mAlive[alive] = true;
+      alive++;
+    }
+
+    return alive;
+  }
+
+  PathQueue         mPaths;
+  ShadowQueue       mShadows;
+  std::vector<char> mAlive;
+  int               mIteration;
+};
@@ -17,6 +17,282 @@
 #include <string>
 #include <set>
 #include <sstream>
+#include <limits>
+
+//////////////////////////////////////////////////////////////////////////
+// Hands the counters and the busy time of the calling thread over to the
+// statistics of the benchmark suite, called at the end of every parallel
+// region. Without statistics the counters are simply dropped.
+
+void collectStats(
+  const Config &aConfig,
+  int          aThreadId,
+  double       aBusyTime)
+{
+  if(aConfig.mStats)
+    aConfig.mStats->Collect(aThreadId, aBusyTime);
+  else
+    memset(&g_ThreadStats, 0, sizeof(g_ThreadStats));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Tiled rendering, every iteration is split into tiles which all threads
+// take from a TileScheduler. All renderers add into aoRadiance, each
+// thread uses the random number generator of its own renderer.
+// Runs until aEndIteration or the wall clock time aEndTime is reached,
+// returns the number of iterations done.
+
+int renderTiled(
+  const Config     &aConfig,
+  AbstractRenderer **aRenderers,
+  int              aFirstIteration,
+  int              aEndIteration,
+  double           aEndTime,
+  Framebuffer      &aoRadiance)
+{
+  const Vec2f resolution = aConfig.mScene->mCamera.mResolution;
+
+  TileScheduler scheduler(Vec2i(int(resolution.x), int(resolution.y)),
+    aConfig.mTileSize, aConfig.mNumThreads);
+
+  int iter = aFirstIteration;
+
+  while(iter < aEndIteration && omp_get_wtime() < aEndTime)
+  {
+    scheduler.Reset();
+
+#pragma omp parallel
+    {
+      const int    threadId     = omp_get_thread_num();
+      const double threadStartT = omp_get_wtime();
+      Tile tile;
+
+      while(scheduler.Next(threadId, tile))
+        aRenderers[threadId]->RunTile(tile, iter, aoRadiance);
+
+      collectStats(aConfig, threadId, omp_get_wtime() - threadStartT);
+    }
+
+    iter++;
+  }
+
+  return iter - aFirstIteration;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Splatting renderers (light tracer, BPT) add to arbitrary pixels. They
+// share one SplatBuffer, each thread logs its splats and flushes them
+// with atomic adds, so there is no framebuffer per thread to merge.
+// Same interface as renderTiled.
+
+int renderSplatted(
+  const Config     &aConfig,
+  AbstractRenderer **aRenderers,
+  int              aFirstIteration,
+  int              aEndIteration,
+  double           aEndTime,
+  Framebuffer      &aoRadiance)
+{
+  SplatBuffer splatBuffer;
+  splatBuffer.Setup(aConfig.mScene->mCamera.mResolution);
+
+  int nextIteration = aFirstIteration;
+
+#pragma omp parallel
+  {
+    const int    threadId     = omp_get_thread_num();
+    const double threadStartT = omp_get_wtime();
+    AbstractRenderer *renderer = aRenderers[threadId];
+
+    SplatLog splatLog(splatBuffer);
+    renderer->SetSplatLog(&splatLog);
+
+    while(omp_get_wtime() < aEndTime)
+    {
+      int iter;
+
+#pragma omp atomic capture
+      iter = nextIteration++;
+
+      if(iter >= aEndIteration)
+        break;
+
+      renderer->RunIteration(iter);
+    }
+
+    splatLog.Flush();
+    renderer->SetSplatLog(NULL);
+
+    collectStats(aConfig, threadId, omp_get_wtime() - threadStartT);
+  }
+
+  splatBuffer.Resolve(aoRadiance, 1.f);
+
+  return std::min(nextIteration, aEndIteration) - aFirstIteration;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Adaptive sampling, renders one iteration at a time. After each the
+// per pixel statistics of aoRadiance decide which pixels get samples in
+// the next one. Stops at aEndTime, when no pixel is active or when
+// aoSamples reaches aSampleBudget. Returns the number of iterations done.
+
+int renderAdaptive(
+  const Config     &aConfig,
+  AbstractRenderer **aRenderers,
+  int              aFirstIteration,
+  double           aEndTime,
+  long long        aSampleBudget,
+  bool             aUpdateActive,
+  Framebuffer      &aoRadiance,
+  long long        &aoSamples)
+{
+  int iter = aFirstIteration;
+  int activePixels = aoRadiance.GetActiveCount();
+
+  while(activePixels > 0 && aoSamples < aSampleBudget)
+  {
+    if(renderTiled(aConfig, aRenderers, iter, iter + 1, aEndTime, aoRadiance) == 0)
+      break;
+
+    aoRadiance.CountSamples();
+    aoSamples += activePixels;
+    iter++;
+
+    if(aUpdateActive)
+      activePixels = aoRadiance.UpdateActive(aConfig.mAdaptiveThreshold,
+        aConfig.mAdaptiveMinSamples, aConfig.mAdaptiveMaxSamples);
+  }
+
+  return iter - aFirstIteration;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Rendering into one radiance buffer shared by all threads, used by
+// renderTiled and renderSplatted. Progressive when checkpoints are
+// enabled: the job is split into passes of mCheckpointInterval seconds
+// and after each pass a checkpoint is handed to a background writer.
+
+float renderShared(
+  const Config     &aConfig,
+  AbstractRenderer **aRenderers,
+  int              *oUsedIterations)
+{
+  const bool tiled = aConfig.mUseTiles && aRenderers[0]->SupportsTiles();
+  bool adaptive    = aConfig.mAdaptiveThreshold > 0;
+
+  if(adaptive && !tiled)
+  {
+    printf("(adaptive sampling needs a tiled renderer, ignored) ");
+    adaptive = false;
+  }
+
+  // Radiance summed over all iterations
+  Framebuffer radiance;
+  radiance.Setup(aConfig.mScene->mCamera.mResolution);
+  int iterations = 0;
+
+  if(aConfig.mResumeFrom)
+  {
+    const Checkpoint &checkpoint = *aConfig.mResumeFrom;
+
+    radiance   = checkpoint.mRadiance;
+    iterations = checkpoint.mIterations;
+
+    // Threads beyond the checkpointed ones keep their fresh seeds
+    const int numStates = std::min(aConfig.mNumThreads, int(checkpoint.mRngStates.size()));
+    for(int i=0; i<numStates; i++)
+      aRenderers[i]->SetRngState(checkpoint.mRngStates[i]);
+
+    if(adaptive && iterations > 0 && !radiance.HasStatistics())
+    {
+      printf("(checkpoint has no per pixel statistics, adaptive sampling disabled) ");
+      adaptive = false;
+    }
+  }
+
+  if(adaptive && !radiance.HasStatistics())
+    radiance.SetupStatistics();
+
+  // Pixels can have different sample counts once statistics exist, also
+  // when continuing an adaptive checkpoint without adaptive sampling
+  const bool perPixel = radiance.HasStatistics();
+  long long  samples  = 0;
+
+  if(perPixel)
+  {
+    samples = radiance.GetTotalSampleCount();
+
+    if(adaptive)
+      radiance.UpdateActive(aConfig.mAdaptiveThreshold,
+        aConfig.mAdaptiveMinSamples, aConfig.mAdaptiveMaxSamples);
+  }
+
+  // Adaptive sampling with -i spends as many samples as -i iterations of
+  // all pixels would, with -t or a target error it is limited only by those
+  // and mAdaptiveMaxSamples
+  const Vec2f resolution   = aConfig.mScene->mCamera.mResolution;
+  const long long numPixels = (long long)resolution.x * (long long)resolution.y;
+  const long long sampleBudget =
+    (perPixel && aConfig.mMaxTime <= 0 && !aConfig.mStopAtThreshold) ?
+    samples + aConfig.mIterations * numPixels :
+    std::numeric_limits<long long>::max();
+
+  CheckpointWriter *writer = NULL;
+  if(aConfig.mCheckpointInterval > 0)
+    writer = new CheckpointWriter(aConfig.mOutputName, aConfig.mCheckpointName);
+
+  // Wall clock time, CPU time of all threads would run out too early
+  const double startT = omp_get_wtime();
+  const double endT   = aConfig.mMaxTime > 0 ?
+    startT + aConfig.mMaxTime : std::numeric_limits<double>::max();
+  const int endIteration = (aConfig.mMaxTime > 0 || perPixel) ?
+    std::numeric_limits<int>::max() : iterations + aConfig.mIterations;
+
+  do
+  {
+    const double passEndT = writer ?
+      std::min(endT, omp_get_wtime() + aConfig.mCheckpointInterval) : endT;
+
+    if(perPixel)
+      iterations += renderAdaptive(aConfig, aRenderers, iterations, passEndT,
+        sampleBudget, adaptive, radiance, samples);
+    else if(tiled)
+      iterations += renderTiled(aConfig, aRenderers, iterations, endIteration, passEndT, radiance);
+    else
+      iterations += renderSplatted(aConfig, aRenderers, iterations, endIteration, passEndT, radiance);
+
+    if(writer)
+    {
+      Checkpoint checkpoint;
+      checkpoint.mAlgorithm  = aConfig.mAlgorithm;
+      checkpoint.mSampler    = aConfig.mSampler;
+      checkpoint.mIterations = iterations;
+      checkpoint.mSceneName  = aConfig.mScene->mSceneName;
+      checkpoint.mRadiance   = radiance;
+
+      for(int i=0; i<aConfig.mNumThreads; i++)
+        checkpoint.mRngStates.push_back(aRenderers[i]->GetRngState());
+
+      writer->Submit(checkpoint);
+    }
+  }
+  while(iterations < endIteration && omp_get_wtime() < endT &&
+    (!perPixel || (samples < sampleBudget && radiance.GetActiveCount() > 0)));
+
+  const double renderEndT = omp_get_wtime();
+
+  // Waits for the last checkpoint to be written
+  delete writer;
+
+  if(oUsedIterations)
+    *oUsedIterations = iterations;
+
+  *aConfig.mFramebuffer = radiance;
+  aConfig.mFramebuffer->DivideBySampleCount(iterations);
+
+  return float(renderEndT - startT);
+}
 
 //////////////////////////////////////////////////////////////////////////
 // The main rendering function, renders what is in aConfig
@@ -39,9 +315,35 @@ float render(
 
     renderers[i]->mMaxPathLength = aConfig.mMaxPathLength;
     renderers[i]->mMinPathLength = aConfig.mMinPathLength;
+    renderers[i]->SetSamplerType(aConfig.mSampler);
+    renderers[i]->SetSamplerSeed(aConfig.mBaseSeed);
   }
 
-  clock_t startT = clock();
+  // Camera based renderers share one framebuffer and split iterations
+  // into tiles, light tracers share one splat buffer
+  if((aConfig.mUseTiles && renderers[0]->SupportsTiles()) ||
+    (aConfig.mUseSplatBuffer && renderers[0]->SupportsSplatting()))
+  {
+    const float time = renderShared(aConfig, renderers, oUsedIterations);
+
+    for(int i=0; i<aConfig.mNumThreads; i++)
+      delete renderers[i];
+
+    delete [] renderers;
+
+    return time;
+  }
+
+  // Otherwise every renderer accumulates whole iterations on its own,
+  // this path does not support checkpoints
+  if(aConfig.mCheckpointInterval > 0 || aConfig.mResumeFrom)
+    printf("(checkpoints need tiles or the splat buffer, ignored) ");
+
+  for(int i=0; i<aConfig.mNumThreads; i++)
+    renderers[i]->SetupFramebuffer();
+
+  // Wall clock time, CPU time of all threads would run out too early
+  const double startT = omp_get_wtime();
   int iter = 0;
 
   // Rendering loop, when we have any time limit, use time-based loop,
@@ -50,27 +352,41 @@ float render(
   {
     // Time based loop
 #pragma omp parallel
-    while(clock() < startT + aConfig.mMaxTime*CLOCKS_PER_SEC)
     {
-      int threadId = omp_get_thread_num();
-      renderers[threadId]->RunIteration(iter);
+      const int    threadId     = omp_get_thread_num();
+      const double threadStartT = omp_get_wtime();
+
+      while(omp_get_wtime() < startT + aConfig.mMaxTime)
+      {
+        int threadIter;
+
+        // Every iteration needs its own index, it keys the samplers
+#pragma omp atomic capture
+        threadIter = iter++; // counts number of iterations
 
-#pragma omp atomic
-      iter++; // counts number of iterations
+        renderers[threadId]->RunIteration(threadIter);
+      }
+
+      collectStats(aConfig, threadId, omp_get_wtime() - threadStartT);
     }
   }
   else
   {
     // Iterations based loop
-#pragma omp parallel for
-    for(iter=0; iter < aConfig.mIterations; iter++)
+#pragma omp parallel
     {
-      int threadId = omp_get_thread_num();
-      renderers[threadId]->RunIteration(iter);
+      const int    threadId     = omp_get_thread_num();
+      const double threadStartT = omp_get_wtime();
+
+#pragma omp for nowait
+      for(iter=0; iter < aConfig.mIterations; iter++)
+        renderers[threadId]->RunIteration(iter);
+
+      collectStats(aConfig, threadId, omp_get_wtime() - threadStartT);
     }
   }
 
-  clock_t endT = clock();
+  const double endT = omp_get_wtime();
 
   if(oUsedIterations)
     *oUsedIterations = iter+1;
@@ -109,7 +425,167 @@ float render(
 
   delete [] renderers;
 
-  return float(endT - startT) / CLOCKS_PER_SEC;
+  return float(endT - startT);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Benchmark suite, renders every scene of g_SceneConfigs with every
+// algorithm for aConfig.mIterations iterations and prints the results as
+// JSON to stdout, progress goes to stderr. Ray counts, rays/sec and path
+// lengths are null unless compiled with RAY_STATS set to 1.
+
+void printStatsJson(
+  const ThreadStats &aStats,
+  double            aTime)
+{
+#if RAY_STATS
+  const long long paths =
+    aStats.Get(kStatPrimaryRays) + aStats.Get(kStatLightPaths);
+
+  printf("      \"rays_per_sec\": %.0f,\n", aStats.GetTotalRays() / aTime);
+  printf("      \"rays\": { \"primary\": %lld, \"indirect\": %lld, \"shadow\": %lld, \"total\": %lld },\n",
+    aStats.Get(kStatPrimaryRays), aStats.GetIndirectRays(),
+    aStats.Get(kStatShadowRays), aStats.GetTotalRays());
+  printf("      \"light_paths\": %lld,\n", aStats.Get(kStatLightPaths));
+  printf("      \"brdf_samples\": %lld,\n", aStats.Get(kStatBrdfSamples));
+  printf("      \"avg_path_length\": %.4f,\n",
+    paths > 0 ? double(aStats.Get(kStatClosestRays)) / paths : 0.0);
+#else
+  (void)aStats;
+  (void)aTime;
+
+  printf("      \"rays_per_sec\": null,\n");
+  printf("      \"rays\": null,\n");
+  printf("      \"light_paths\": null,\n");
+  printf("      \"brdf_samples\": null,\n");
+  printf("      \"avg_path_length\": null,\n");
+#endif
+}
+
+void benchmarkSuite(const Config &aConfig)
+{
+  // Fixed amount of work, nothing written to disk
+  Config config = aConfig;
+  config.mMaxTime            = -1.f;
+  config.mCheckpointInterval = -1.f;
+  config.mResumeFrom         = NULL;
+  config.mAdaptiveThreshold  = -1.f;
+  config.mStopAtThreshold    = false;
+
+  Framebuffer fbuffer;
+  config.mFramebuffer = &fbuffer;
+
+  RenderStats stats;
+  config.mStats = &stats;
+
+  printf("{\n");
+  printf("  \"threads\": %d,\n", config.mNumThreads);
+  printf("  \"resolution\": [%d, %d],\n", config.mResolution.x, config.mResolution.y);
+  printf("  \"iterations\": %d,\n", config.mIterations);
+  printf("  \"sampler\": \"%s\",\n", GetSamplerName(config.mSampler));
+  printf("  \"ray_stats\": %s,\n", RAY_STATS ? "true" : "false");
+  printf("  \"runs\": [");
+
+  const char *separator = "\n";
+
+  for(int s=0; s<SizeOfArray(g_SceneConfigs); s++)
+  {
+    Scene scene;
+    scene.LoadCornellBox(config.mResolution, g_SceneConfigs[s]);
+    config.mScene = &scene;
+
+    for(int a=0; a<(int)Config::kAlgorithmMax; a++)
+    {
+      config.mAlgorithm = Config::Algorithm(a);
+
+      fprintf(stderr, "%s, %s... ", scene.mSceneName.c_str(), Config::GetName(config.mAlgorithm));
+      fflush(stderr);
+
+      stats.Setup(config.mNumThreads);
+      const float time = render(config);
+      const ThreadStats total = stats.GetTotal();
+
+      fprintf(stderr, "%.2f s\n", time);
+
+      printf("%s    {\n", separator);
+      printf("      \"scene\": %d,\n", s);
+      printf("      \"scene_name\": \"%s\",\n", scene.mSceneName.c_str());
+      printf("      \"algorithm\": \"%s\",\n", Config::GetAcronym(config.mAlgorithm));
+      printf("      \"algorithm_name\": \"%s\",\n", Config::GetName(config.mAlgorithm));
+      printf("      \"wall_time\": %.4f,\n", time);
+      printStatsJson(total, time);
+      printf("      \"thread_stats\": [");
+
+      for(int t=0; t<stats.GetThreadCount(); t++)
+      {
+        const ThreadStats &thread = stats.GetThread(t);
+
+        printf("%s\n        { \"busy_time\": %.4f, \"utilization\": %.4f, \"rays\": ",
+          t > 0 ? "," : "", thread.mBusyTime, time > 0 ? thread.mBusyTime / time : 0.0);
+
+        if(RAY_STATS)
+          printf("%lld }", thread.GetTotalRays());
+        else
+          printf("null }");
+      }
+
+      printf("\n      ]\n");
+      printf("    }");
+      separator = ",\n";
+      fflush(stdout);
+    }
+  }
+
+  printf("\n  ]\n");
+  printf("}\n");
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Renders aConfig with 1, 2 and 4 threads. Keyed samplers make the
+// numbers of a sample independent of the thread rendering it, so tiled
+// renders must match bit for bit. Splatting and untiled renders sum in
+// thread dependent order, they only have to match up to rounding.
+
+bool checkThreadIndependence(const Config &aConfig)
+{
+  Config config = aConfig;
+  config.mMaxTime            = -1.f;
+  config.mIterations         = std::max(1, aConfig.mIterations);
+  config.mCheckpointInterval = -1.f;
+  config.mResumeFrom         = NULL;
+
+  AbstractRenderer *renderer = CreateRenderer(config, config.mBaseSeed);
+  const bool tiled = config.mUseTiles && renderer->SupportsTiles();
+  delete renderer;
+  const float tolerance = tiled ? 0.f : 1e-4f;
+
+  printf("Scene:   %s\n", config.mScene->mSceneName.c_str());
+  printf("Check:   %s, %d iteration(s), %s sampler\n", config.GetName(config.mAlgorithm),
+    config.mIterations, GetSamplerName(config.mSampler));
+
+  const int threadCounts[] = { 1, 2, 4 };
+  Framebuffer fbuffers[SizeOfArray(threadCounts)];
+  bool result = true;
+
+  for(int i=0; i<SizeOfArray(threadCounts); i++)
+  {
+    config.mNumThreads  = threadCounts[i];
+    config.mFramebuffer = &fbuffers[i];
+    render(config);
+
+    if(i == 0)
+      continue;
+
+    const float difference = fbuffers[i].GetMaxRelativeDifference(fbuffers[0]);
+    const bool  passed     = difference <= tolerance;
+
+    printf("Threads: %d vs. 1, max. relative difference %g %s\n",
+      threadCounts[i], difference, passed ? "ok" : "FAILED");
+
+    result = result && passed;
+  }
+
+  return result;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -132,16 +608,91 @@ int main(int argc, const char *argv[])
   if(config.mScene == NULL)
     return 1;
 
+  // Benchmarks do not render the scene
+  if(config.mBenchmarkBvh || config.mBenchmarkSimd || config.mBenchmarkSplat ||
+    config.mBenchmarkSamplers || config.mBenchmarkRender)
+  {
+    if(config.mBenchmarkBvh)
+      BenchmarkBvhScaling();
+    if(config.mBenchmarkSimd)
+      BenchmarkPackedGeometry();
+    if(config.mBenchmarkSplat)
+      BenchmarkSplatting();
+    if(config.mBenchmarkSamplers)
+      BenchmarkSamplers();
+    if(config.mBenchmarkRender)
+      benchmarkSuite(config);
+
+    delete config.mScene;
+    return 0;
+  }
+
+  if(config.mCheckThreads)
+  {
+    const bool passed = checkThreadIndependence(config);
+    delete config.mScene;
+    return passed ? 0 : 1;
+  }
+
   // Sets up framebuffer and number of threads
   Framebuffer fbuffer;
   config.mFramebuffer = &fbuffer;
 
+  // Loads the checkpoint to continue from
+  Checkpoint checkpoint;
+
+  if(config.mResume)
+  {
+    if(!checkpoint.Load(config.mCheckpointName))
+    {
+      printf("Cannot read checkpoint %s\n", config.mCheckpointName.c_str());
+      delete config.mScene;
+      return 1;
+    }
+
+    const Vec2f &resolution = checkpoint.mRadiance.GetResolution();
+
+    if(checkpoint.mAlgorithm != config.mAlgorithm ||
+      checkpoint.mSceneName != config.mScene->mSceneName ||
+      resolution.x != config.mScene->mCamera.mResolution.x ||
+      resolution.y != config.mScene->mCamera.mResolution.y)
+    {
+      printf("Checkpoint %s was rendered with a different scene or algorithm\n",
+        config.mCheckpointName.c_str());
+      delete config.mScene;
+      return 1;
+    }
+
+    // Samples of different samplers must not be averaged
+    if(checkpoint.mSampler != config.mSampler)
+    {
+      printf("Checkpoint %s was rendered with a different sampler (%s)\n",
+        config.mCheckpointName.c_str(), GetSamplerName(SamplerType(checkpoint.mSampler)));
+      delete config.mScene;
+      return 1;
+    }
+
+    config.mResumeFrom = &checkpoint;
+  }
+
   // Prints what we are doing
   printf("Scene:   %s\n", config.mScene->mSceneName.c_str());
-  if(config.mMaxTime > 0)
+  if(config.mStopAtThreshold)
+  {
+    printf("Target:  %g relative error, at most %d samples per pixel",
+      config.mAdaptiveThreshold, config.mAdaptiveMaxSamples);
+    if(config.mMaxTime > 0)
+      printf(" or %g seconds", config.mMaxTime);
+    printf("\n");
+  }
+  else if(config.mMaxTime > 0)
     printf("Target:  %g seconds render time\n", config.mMaxTime);
   else
     printf("Target:  %d iteration(s)\n", config.mIterations);
+  printf("Sampler: %s\n", GetSamplerName(config.mSampler));
+  if(config.mResumeFrom)
+    printf("Resume:  %d iteration(s) from %s\n",
+      checkpoint.mIterations, config.mCheckpointName.c_str());
 
   // Renders the image
   printf("Running: %s... ", config.GetName(config.mAlgorithm));
@@ -149,15 +700,24 @@ int main(int argc, const char *argv[])
   float time = render(config);
   printf("done in %.2f s\n", time);
 
-  // Saves the image
-  std::string extension = config.mOutputName.substr(config.mOutputName.length() - 3, 3);
+  if(fbuffer.HasStatistics())
+  {
+    const Vec2f &resolution = fbuffer.GetResolution();
+    const double numPixels  = double(resolution.x) * resolution.y;
 
-  if(extension == "bmp")
-    fbuffer.SaveBMP(config.mOutputName.c_str(), 2.2f /*gamma*/);
-  else if(extension == "hdr")
-    fbuffer.SaveHDR(config.mOutputName.c_str());
-  else
-    printf("Used unknown extension %s\n", extension.c_str());
+    printf("Samples: %.1f per pixel on average", fbuffer.GetTotalSampleCount() / numPixels);
+
+    if(config.mAdaptiveThreshold > 0)
+      printf(", %.1f%% of pixels above %g relative error",
+        100.0 * fbuffer.GetActiveCount() / numPixels, config.mAdaptiveThreshold);
+
+    printf("\n");
+  }
+
+  // Saves the image
+  if(!fbuffer.Save(config.mOutputName))
+    printf("Cannot write %s, use extension .bmp or .hdr on a writable path\n",
+      config.mOutputName.c_str());
 
   // Scene cleanup
   delete config.mScene;
@@ -4,22 +4,75 @@
 #include <cmath>
 #include "scene.hxx"
 #include "framebuffer.hxx"
+#include "scheduler.hxx"
+#include "splatbuffer.hxx"
+#include "rng.hxx"
 
 class AbstractRenderer
 {
 public:
 
-  AbstractRenderer(const Scene& aScene) : mScene(aScene)
+  AbstractRenderer(
+    const Scene& aScene,
+    int aSeed = 1234
+    ) :
+  mRng(aSeed),
+    mScene(aScene)
   {
     mMinPathLength = 0;
     mMaxPathLength = 2;
     mIterations = 0;
-    mFramebuffer.Setup(aScene.mCamera.mResolution);
+    mSplatLog = NULL;
   }
 
   virtual ~AbstractRenderer(){}
 
-  virtual void RunIteration(int aIteration) = 0;
+  //! Allocates the renderer's own framebuffer, needed by RunIteration.
+  //! Tiled rendering writes into a shared framebuffer and skips this.
+  void SetupFramebuffer()
+  {
+    mFramebuffer.Setup(mScene.mCamera.mResolution);
+  }
+
+  //! Renders one iteration of the whole image into the renderer's own
+  //! framebuffer, tile by tile through RunTile. Renderers without tiles
+  //! override it.
+  virtual void RunIteration(int aIteration)
+  {
+    const Vec2i resolution(
+      int(mScene.mCamera.mResolution.x),
+      int(mScene.mCamera.mResolution.y));
+
+    const TileScheduler tiles(resolution, kTileSize, 1);
+
+    for(int i=0; i<tiles.GetTileCount(); i++)
+      RunTile(tiles.GetTile(i), aIteration, mFramebuffer);
+
+    mIterations++;
+  }
+
+  //! Whether RunTile is implemented. Only renderers whose samples
+  //! always land in the pixel they were generated for can support it,
+  //! the others override RunIteration and return false.
+  virtual bool SupportsTiles() const { return true; }
+
+  //! Renders one tile of an iteration into a framebuffer shared by all
+  //! threads. Tiles do not overlap, so no synchronization is needed.
+  virtual void RunTile(
+    const Tile  &/*aTile*/,
+    int         /*aIteration*/,
+    Framebuffer &/*oFramebuffer*/)
+  {}
+
+  //! Whether the renderer adds to random pixels through splat()
+  virtual bool SupportsSplatting() const { return false; }
+
+  //! Redirects splat() into a log flushed into a SplatBuffer shared by
+  //! all threads, the renderer's own framebuffer is not needed then
+  void SetSplatLog(SplatLog *aSplatLog)
+  {
+    mSplatLog = aSplatLog;
+  }
 
   void GetFramebuffer(Framebuffer& oFramebuffer)
   {
@@ -29,9 +82,35 @@ public:
       oFramebuffer.Scale(1.f / mIterations);
   }
 
+  //! Random number generator state, stored in checkpoints
+  std::string GetRngState() const { return mRng.GetState(); }
+  void SetRngState(const std::string &aState) { mRng.SetState(aState); }
+
+  void SetSamplerType(SamplerType aType) { mRng.SetType(aType); }
+  void SetSamplerSeed(int aSeed) { mRng.SetSamplerSeed(aSeed); }
+
   //! Whether this renderer was used at all
   bool WasUsed() const { return mIterations > 0; }
 
+  int GetIterations() const { return mIterations; }
+
+protected:
+
+  //! Tile size of RunIteration, bounds the path queues of the wavefront
+  //! path tracer
+  enum { kTileSize = 32 };
+
+  //! Adds a contribution to an arbitrary pixel
+  void splat(
+    const Vec2f& aSample,
+    const Vec3f& aColor)
+  {
+    if(mSplatLog)
+      mSplatLog->Add(aSample, aColor);
+    else
+      mFramebuffer.AddColor(aSample, aColor);
+  }
+
 public:
 
   uint         mMaxPathLength;
@@ -40,6 +119,8 @@ public:
 protected:
 
   int          mIterations;
+  Rng          mRng;
   Framebuffer  mFramebuffer;
+  SplatLog     *mSplatLog;
   const Scene& mScene;
 };
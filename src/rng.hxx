@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <cmath>
+#include <string>
+#include <sstream>
 
 #if defined(_MSC_VER)
 #   if (_MSC_VER < 1600)
@@ -12,10 +14,12 @@
 #if !defined(LEGACY_RNG)
 
 #include <random>
-class Rng
+
+// Sequential generator, C++11 Mersenne Twister
+class StreamRng
 {
 public:
-  Rng(int aSeed = 1234):
+  StreamRng(int aSeed = 1234):
       mRng(aSeed)
       {}
 
@@ -51,6 +55,20 @@ public:
         return Vec3f(a, b, c);
       }
 
+      // Generator state as text, used by checkpoints
+      std::string GetState() const
+      {
+        std::ostringstream oss;
+        oss << mRng;
+        return oss.str();
+      }
+
+      void SetState(const std::string &aState)
+      {
+        std::istringstream iss(aState);
+        iss >> mRng;
+      }
+
 private:
 
   std::mt19937_64 mRng;
@@ -88,6 +106,23 @@ public:
     return mState0;
   }
 
+  void StoreState(
+    uint *oState0,
+    uint *oState1) const
+  {
+    *oState0 = mState0;
+    *oState1 = mState1;
+  }
+
+  void LoadState(
+    uint aState0,
+    uint aState1,
+    uint /*aDimension*/)
+  {
+    mState0 = aState0;
+    mState1 = aState1;
+  }
+
 private:
 
   uint mState0, mState1;
@@ -134,7 +169,7 @@ public:
   //////////////////////////////////////////////////////////////////////////
   void StoreState(
     uint *oState1,
-    uint *oState2)
+    uint *oState2) const
   {
     mImpl.StoreState(oState1, oState2);
   }
@@ -147,6 +182,25 @@ public:
     mImpl.LoadState(aState1, aState2, aDimension);
   }
 
+  // Generator state as text, used by checkpoints
+  std::string GetState() const
+  {
+    uint state1, state2;
+    StoreState(&state1, &state2);
+
+    std::ostringstream oss;
+    oss << state1 << " " << state2;
+    return oss.str();
+  }
+
+  void SetState(const std::string &aState)
+  {
+    uint state1 = 0, state2 = 0;
+    std::istringstream iss(aState);
+    iss >> state1 >> state2;
+    LoadState(state1, state2, 0);
+  }
+
 protected:
 
   uint getImpl(void)
@@ -159,6 +213,357 @@ private:
   RandomImpl mImpl;
 };
 
-typedef RandomBase<TeaImpl> Rng;
+// Sequential generator, Tiny Encryption Algorithm for old compilers
+typedef RandomBase<TeaImpl> StreamRng;
 
 #endif
+
+//////////////////////////////////////////////////////////////////////////
+// Samplers
+//
+// Rng is what renderers draw their random numbers from. It is one of
+//   kSamplerStream  the sequential StreamRng above,
+//   kSamplerPcg     a counter based generator, every number is a hash of
+//                   (key, sample, dimension),
+//   kSamplerSobol   Owen scrambled Sobol (0,2) sequence, padded: every
+//                   pair of dimensions is an independently scrambled and
+//                   shuffled 2D sequence (Burley, Practical Hash-based
+//                   Owen Scrambling, JCGT 2020).
+// Renderers call StartSample with the pixel (or light path) and the
+// iteration before drawing a sample, the numbers are then the same no
+// matter which thread renders it and in which order. That requires all
+// threads to share the sampler seed (SetSamplerSeed), only the stream
+// is seeded per thread. The stream sampler ignores StartSample, its
+// numbers depend on the order of calls.
+
+enum SamplerType
+{
+  kSamplerStream = 0,
+  kSamplerPcg,
+  kSamplerSobol,
+  kSamplerMax
+};
+
+inline const char* GetSamplerName(SamplerType aSampler)
+{
+  static const char* samplerNames[kSamplerMax] = { "stream", "pcg", "sobol" };
+
+  if(aSampler < 0 || aSampler >= kSamplerMax)
+    return "unknown";
+  return samplerNames[aSampler];
+}
+
+namespace SamplerHash
+{
+  // PCG hash (Jarzynski and Olano, Hash Functions for GPU Rendering)
+  inline uint Pcg(uint aValue)
+  {
+    const uint state = aValue * 747796405u + 2891336453u;
+    const uint word  = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+  }
+
+  inline uint Combine(uint aSeed, uint aValue)
+  {
+    return Pcg(aSeed ^ (aValue + 0x9e3779b9u + (aSeed << 6) + (aSeed >> 2)));
+  }
+
+  inline uint ReverseBits(uint aValue)
+  {
+    aValue = (aValue << 16) | (aValue >> 16);
+    aValue = ((aValue & 0x00ff00ffu) << 8) | ((aValue & 0xff00ff00u) >> 8);
+    aValue = ((aValue & 0x0f0f0f0fu) << 4) | ((aValue & 0xf0f0f0f0u) >> 4);
+    aValue = ((aValue & 0x33333333u) << 2) | ((aValue & 0xccccccccu) >> 2);
+    aValue = ((aValue & 0x55555555u) << 1) | ((aValue & 0xaaaaaaaau) >> 1);
+    return aValue;
+  }
+
+  // Laine-Karras permutation, bits only affect higher ones. This is
+  // Owen scrambling of the reversed bits of aValue.
+  inline uint LaineKarras(uint aValue, uint aSeed)
+  {
+    uint x = aValue + aSeed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+  }
+
+  // Owen scrambling of the bits of aValue, highest bit first
+  inline uint NestedUniformScramble(uint aValue, uint aSeed)
+  {
+    return ReverseBits(LaineKarras(ReverseBits(aValue), aSeed));
+  }
+
+  // Scrambled first Sobol dimension. That is the index with reversed
+  // bits, so the reversal before scrambling cancels out.
+  inline uint ScrambledSobol0(uint aIndex, uint aSeed)
+  {
+    return ReverseBits(LaineKarras(aIndex, aSeed));
+  }
+
+  // Second Sobol dimension, the first one is ReverseBits. The generator
+  // matrix is applied a byte at a time from precomputed tables.
+  struct Sobol1Table
+  {
+    Sobol1Table()
+    {
+      uint directions[32];
+      uint v = 1u << 31;
+
+      for(int bit=0; bit<32; bit++, v ^= v >> 1)
+        directions[bit] = v;
+
+      for(int byte=0; byte<4; byte++)
+      {
+        for(int value=0; value<256; value++)
+        {
+          uint result = 0;
+
+          for(int bit=0; bit<8; bit++)
+            if(value & (1 << bit))
+              result ^= directions[byte * 8 + bit];
+
+          mEntries[byte][value] = result;
+        }
+      }
+    }
+
+    uint mEntries[4][256];
+  };
+
+  inline uint Sobol1(uint aIndex)
+  {
+    static const Sobol1Table table;
+
+    return table.mEntries[0][aIndex & 0xff] ^
+      table.mEntries[1][(aIndex >> 8) & 0xff] ^
+      table.mEntries[2][(aIndex >> 16) & 0xff] ^
+      table.mEntries[3][aIndex >> 24];
+  }
+
+  // Top 24 bits to [0, 1)
+  inline float ToFloat(uint aValue)
+  {
+    return float(aValue >> 8) * (1.f / 16777216.f);
+  }
+}
+
+class Rng
+{
+public:
+
+  Rng(int aSeed = 1234, SamplerType aType = kSamplerPcg) :
+    mType(aType),
+    mStream(NULL),
+    mStreamSeed(aSeed),
+    mSeed(SamplerHash::Pcg(uint(aSeed))),
+    mKey(mSeed),
+    mSample(0),
+    mDimension(0)
+  {
+    if(mType == kSamplerStream)
+      mStream = new StreamRng(mStreamSeed);
+  }
+
+  Rng(const Rng &aOther) :
+    mType(aOther.mType),
+    mStream(aOther.mStream ? new StreamRng(*aOther.mStream) : NULL),
+    mStreamSeed(aOther.mStreamSeed),
+    mSeed(aOther.mSeed),
+    mKey(aOther.mKey),
+    mSample(aOther.mSample),
+    mDimension(aOther.mDimension)
+  {}
+
+  Rng& operator=(const Rng &aOther)
+  {
+    if(this != &aOther)
+    {
+      delete mStream;
+      mStream     = aOther.mStream ? new StreamRng(*aOther.mStream) : NULL;
+      mType       = aOther.mType;
+      mStreamSeed = aOther.mStreamSeed;
+      mSeed       = aOther.mSeed;
+      mKey        = aOther.mKey;
+      mSample     = aOther.mSample;
+      mDimension  = aOther.mDimension;
+    }
+    return *this;
+  }
+
+  ~Rng()
+  {
+    delete mStream;
+  }
+
+  // The stream generator (mt19937_64 is 2.5 KB) only exists while the
+  // stream sampler is used, the keyed samplers need no state besides
+  // the key
+  void SetType(SamplerType aType)
+  {
+    mType = aType;
+
+    if(mType == kSamplerStream && !mStream)
+      mStream = new StreamRng(mStreamSeed);
+    else if(mType != kSamplerStream)
+    {
+      delete mStream;
+      mStream = NULL;
+    }
+  }
+
+  // Seed of the keyed samplers, must be the same in all threads. The
+  // seed passed to the constructor only seeds the stream then.
+  void SetSamplerSeed(int aSeed)
+  {
+    mSeed = SamplerHash::Pcg(uint(aSeed));
+    mKey  = mSeed;
+  }
+
+  SamplerType GetType() const
+  {
+    return mType;
+  }
+
+  // Keys all following numbers by aPixel and aSample, starting at
+  // aDimension. Used to continue a sample which was interrupted by
+  // others, with the dimension returned by GetDimension.
+  void StartSample(
+    uint aPixel,
+    uint aSample,
+    uint aDimension = 0)
+  {
+    mKey       = SamplerHash::Combine(mSeed, aPixel);
+    mSample    = aSample;
+    mDimension = aDimension;
+  }
+
+  uint GetDimension() const
+  {
+    return mDimension;
+  }
+
+  uint GetUint()
+  {
+    switch(mType)
+    {
+    case kSamplerStream:
+      return mStream->GetUint();
+    case kSamplerSobol:
+      {
+        const uint seed   = dimensionSeed();
+        const uint result = SamplerHash::ScrambledSobol0(shuffledIndex(seed), SamplerHash::Pcg(seed + 1));
+        mDimension++;
+        return result;
+      }
+    default:
+      return counterHash();
+    }
+  }
+
+  int GetInt()
+  {
+    return int(GetUint() >> 1);
+  }
+
+  float GetFloat()
+  {
+    if(mType == kSamplerStream)
+      return mStream->GetFloat();
+
+    return SamplerHash::ToFloat(GetUint());
+  }
+
+  Vec2f GetVec2f()
+  {
+    if(mType == kSamplerSobol)
+    {
+      // Both coordinates come from the same scrambled (0,2) sequence
+      const uint seed  = dimensionSeed();
+      const uint index = shuffledIndex(seed);
+      const float a = SamplerHash::ToFloat(
+        SamplerHash::ScrambledSobol0(index, SamplerHash::Pcg(seed + 1)));
+      const float b = SamplerHash::ToFloat(
+        SamplerHash::NestedUniformScramble(SamplerHash::Sobol1(index), SamplerHash::Pcg(seed + 2)));
+
+      mDimension++;
+      return Vec2f(a, b);
+    }
+
+    float a = GetFloat();
+    float b = GetFloat();
+
+    return Vec2f(a, b);
+  }
+
+  Vec3f GetVec3f()
+  {
+    const Vec2f ab = GetVec2f();
+    const float c  = GetFloat();
+
+    return Vec3f(ab.x, ab.y, c);
+  }
+
+  // State of the active sampler as text, used by checkpoints. The type
+  // has to be set before SetState.
+  std::string GetState() const
+  {
+    if(mType == kSamplerStream)
+      return mStream->GetState();
+
+    std::ostringstream oss;
+    oss << mKey << " " << mSample << " " << mDimension;
+    return oss.str();
+  }
+
+  void SetState(const std::string &aState)
+  {
+    if(mType == kSamplerStream)
+    {
+      mStream->SetState(aState);
+      return;
+    }
+
+    std::istringstream iss(aState);
+    iss >> mKey >> mSample >> mDimension;
+  }
+
+private:
+
+  // Every GetUint of the PCG sampler is its own dimension. Without
+  // StartSample this is a plain counter based stream.
+  uint counterHash()
+  {
+    const uint result = SamplerHash::Combine(
+      SamplerHash::Combine(mKey, mSample), mDimension);
+
+    if(++mDimension == 0)
+      mSample++;
+
+    return result;
+  }
+
+  // Sobol uses one dimension per pair of coordinates. The seed of the
+  // current one shuffles the index, hashes of seed + 1 and seed + 2
+  // scramble the coordinates.
+  uint dimensionSeed() const
+  {
+    return SamplerHash::Combine(mKey, mDimension);
+  }
+
+  // Sample index shuffled so that dimensions are not correlated
+  uint shuffledIndex(uint aSeed) const
+  {
+    return SamplerHash::NestedUniformScramble(mSample, aSeed);
+  }
+
+  SamplerType mType;
+  StreamRng   *mStream;     //!< Only for kSamplerStream
+  int         mStreamSeed;
+  uint        mSeed;
+  uint        mKey;
+  uint        mSample;
+  uint        mDimension;
+};
@@ -5,21 +5,28 @@
 #include <cmath>
 #include "math.hxx"
 #include "geometry.hxx"
+#include "bvh.hxx"
 #include "camera.hxx"
 #include "materials.hxx"
 #include "lights.hxx"
+#include "stats.hxx"
+#include "mesh.hxx"
+#include "mesh_loader.hxx"
+#include "scene_cache.hxx"
 
 class Scene
 {
 public:
   Scene() :
       mGeometry(NULL),
-        mBackground(NULL)
+        mBackground(NULL),
+        mCache(NULL)
       {}
 
       ~Scene()
       {
         delete mGeometry;
+        delete mCache; // after the geometry, a mesh may point into it
 
         for(size_t i=0; i<mLights.size(); i++)
           delete mLights[i];
@@ -32,6 +39,7 @@ public:
         const Ray &aRay,
         Isect     &oResult) const
       {
+        STATS_COUNT(kStatClosestRays);
         bool hit = mGeometry->Intersect(aRay, oResult);
 
         if(hit)
@@ -52,6 +60,7 @@ public:
         const Vec3f &aDir,
         float aTMax) const
       {
+        STATS_COUNT(kStatShadowRays);
         Ray ray;
         ray.org  = aPoint + aDir * EPS_RAY;
         ray.dir  = aDir;
@@ -338,6 +347,93 @@ public:
           mLights.push_back(l);
           mBackground = l;
         }
+
+        BuildAccelerationStructure();
+      }
+
+      //////////////////////////////////////////////////////////////////////////
+      // Loads an OBJ or PLY mesh. Every emitting triangle (MTL Ke) becomes
+      // an AreaLight with a material ID of its own in mMaterial2Light, as
+      // the ceiling of the Cornell box does. Without emitters the scene is
+      // lit by a BackgroundLight. With aUseCache the scene is mapped from
+      // <aFilename>.pg3cache when that is up to date, otherwise the mesh is
+      // parsed and the cache is written. Prints the reason on failure.
+      bool LoadMesh(
+        const std::string &aFilename,
+        const Vec2i       &aResolution,
+        bool              aUseCache  = true,
+        bool              *oFromCache = NULL)
+      {
+        FileStamp source;
+
+        if(!source.Get(aFilename))
+        {
+          printf("Cannot open %s\n", aFilename.c_str());
+          return false;
+        }
+
+        const size_t slash = aFilename.find_last_of("/\\");
+        mSceneName    = aFilename.substr(slash == std::string::npos ? 0 : slash + 1);
+        mSceneAcronym = mSceneName.substr(0, mSceneName.rfind('.'));
+
+        delete mGeometry;
+        TriangleMesh *mesh = new TriangleMesh;
+        mGeometry = mesh;
+
+        const std::string cacheName = aFilename + ".pg3cache";
+        SceneCache *cache = new SceneCache;
+
+        if(aUseCache && cache->Map(cacheName, source))
+        {
+          cache->SetupMesh(*mesh);
+          setupMeshMaterials(cache->GetMaterials(), cache->GetMaterialCount(),
+            cache->GetLights(), cache->GetLightCount());
+
+          mCache = cache;
+        }
+        else
+        {
+          delete cache;
+
+          MeshData data;
+          if(!MeshLoader::Load(aFilename, data))
+            return false;
+
+          std::vector<CacheMaterial> materials;
+          std::vector<CacheLight>    lights;
+          std::vector<int>           matIDs;
+          convertMeshMaterials(data, materials, lights, matIDs);
+
+          mesh->Build(data.mVertices, data.mIndices, matIDs);
+          setupMeshMaterials(materials.empty() ? NULL : &materials[0], (int)materials.size(),
+            lights.empty() ? NULL : &lights[0], (int)lights.size());
+
+          if(aUseCache && !SceneCache::Save(cacheName, source, data.mLibraries, materials, lights, *mesh))
+            printf("Cannot write scene cache %s\n", cacheName.c_str());
+        }
+
+        if(oFromCache)
+          *oFromCache = (mCache != NULL);
+
+        setupMeshCamera(aResolution);
+        return true;
+      }
+
+      //////////////////////////////////////////////////////////////////////////
+      // Replaces the flat geometry list by a BVH over the same primitives,
+      // must be called once all geometry of the scene has been loaded
+      void BuildAccelerationStructure()
+      {
+        GeometryList *geometryList = dynamic_cast<GeometryList*>(mGeometry);
+
+        if(geometryList == NULL)
+          return;
+
+        BVH *bvh = new BVH;
+        bvh->Build(geometryList->mGeometry);
+
+        delete geometryList;
+        mGeometry = bvh;
       }
 
       static std::string GetSceneName(
@@ -425,6 +521,142 @@ public:
         return name;
       }
 
+private:
+
+      // Material slots and lights of a loaded mesh, oMatIDs gets the slot
+      // of every triangle. Emitting triangles get a slot each, so that
+      // mMaterial2Light can tell their lights apart.
+      static void convertMeshMaterials(
+        const MeshData             &aMesh,
+        std::vector<CacheMaterial> &oMaterials,
+        std::vector<CacheLight>    &oLights,
+        std::vector<int>           &oMatIDs)
+      {
+        const int numMaterials = (int)aMesh.mMaterialList.size();
+        std::vector<int> baseSlot(numMaterials, -1);
+
+        for(int i=0; i<numMaterials; i++)
+        {
+          const MeshMaterial &material = aMesh.mMaterialList[i];
+
+          if(material.mEmission.Max() > 0)
+            continue;
+
+          CacheMaterial slot;
+          slot.mDiffuse  = material.mDiffuse;
+          slot.mGlossy   = material.mGlossy;
+          slot.mExponent = material.mExponent;
+          slot.mMirror   = material.mMirror ? 1 : 0;
+          slot.mBase     = (int)oMaterials.size();
+
+          baseSlot[i] = slot.mBase;
+          oMaterials.push_back(slot);
+        }
+
+        // Emitters only emit, like the lights of the Cornell box
+        std::vector<int> emitterBase(numMaterials, -1);
+        const int numTriangles = (int)aMesh.mMaterials.size();
+        oMatIDs.resize(numTriangles);
+
+        for(int t=0; t<numTriangles; t++)
+        {
+          const int material = aMesh.mMaterials[t];
+
+          if(baseSlot[material] >= 0)
+          {
+            oMatIDs[t] = baseSlot[material];
+            continue;
+          }
+
+          CacheMaterial slot;
+          slot.mDiffuse  = Vec3f(0);
+          slot.mGlossy   = Vec3f(0);
+          slot.mExponent = 1.f;
+          slot.mMirror   = 0;
+          slot.mBase     = (int)oMaterials.size();
+
+          if(emitterBase[material] < 0)
+            emitterBase[material] = slot.mBase;
+          else
+            slot.mBase = emitterBase[material];
+
+          CacheLight light;
+          light.mP0       = aMesh.mVertices[aMesh.mIndices[3 * t + 0]];
+          light.mP1       = aMesh.mVertices[aMesh.mIndices[3 * t + 1]];
+          light.mP2       = aMesh.mVertices[aMesh.mIndices[3 * t + 2]];
+          light.mRadiance = aMesh.mMaterialList[material].mEmission;
+          light.mMatID    = (int)oMaterials.size();
+
+          oMatIDs[t] = light.mMatID;
+          oMaterials.push_back(slot);
+          oLights.push_back(light);
+        }
+      }
+
+      void setupMeshMaterials(
+        const CacheMaterial *aMaterials,
+        int                 aNumMaterials,
+        const CacheLight    *aLights,
+        int                 aNumLights)
+      {
+        const size_t first = mMaterials.size();
+
+        for(int i=0; i<aNumMaterials; i++)
+        {
+          const CacheMaterial &slot = aMaterials[i];
+
+          // Slots sharing a material reuse the object of the first one
+          if(slot.mBase >= 0 && slot.mBase < i)
+          {
+            mMaterials.push_back(mMaterials[first + slot.mBase]);
+            continue;
+          }
+
+          Material *mat = slot.mMirror ? new MaterialMirror() : new Material();
+          mat->mDiffuseReflectance = slot.mDiffuse;
+          mat->mPhongReflectance   = slot.mGlossy;
+          mat->mPhongExponent      = slot.mExponent;
+          mMaterials.push_back(mat);
+        }
+
+        for(int i=0; i<aNumLights; i++)
+        {
+          AreaLight *l = new AreaLight(aLights[i].mP0, aLights[i].mP1, aLights[i].mP2);
+          l->mRadiance = aLights[i].mRadiance;
+          mMaterial2Light.insert(std::make_pair(aLights[i].mMatID, (int)mLights.size()));
+          mLights.push_back(l);
+        }
+
+        if(aNumLights == 0)
+        {
+          BackgroundLight *l = new BackgroundLight;
+          mLights.push_back(l);
+          mBackground = l;
+        }
+      }
+
+      // Looks at the bounding sphere of the scene along +y, z up, with the
+      // horizontal field of view of the Cornell box camera
+      void setupMeshCamera(const Vec2i &aResolution)
+      {
+        Vec3f bboxMin(INFTY_F), bboxMax(-INFTY_F);
+        mGeometry->GrowBBox(bboxMin, bboxMax);
+
+        if(bboxMin.x > bboxMax.x)
+          bboxMin = bboxMax = Vec3f(0);
+
+        const float fov      = 45.f;
+        const Vec3f center   = (bboxMin + bboxMax) * Vec3f(0.5f);
+        const float radius   = std::max(0.5f * (bboxMax - bboxMin).Length(), 1e-3f);
+        const float distance = radius / std::sin(0.5f * fov * PI_F / 180.f);
+
+        mCamera.Setup(
+          center - Vec3f(0.f, distance, 0.f),
+          Vec3f(0.f, 1.f, 0.f),
+          Vec3f(0.f, 0.f, 1.f),
+          Vec2f(float(aResolution.x), float(aResolution.y)), fov);
+      }
+
 public:
 
   AbstractGeometry      *mGeometry;
@@ -437,4 +669,6 @@ public:
 
   std::string           mSceneName;
   std::string           mSceneAcronym;
+
+  SceneCache            *mCache; //!< Mapped cache of a mesh scene, or NULL
 };
@@ -0,0 +1,581 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "math.hxx"
+#include "utils.hxx"
+#include "bvh.hxx"
+#include "mesh.hxx"
+
+#if defined(_WIN32)
+#   if !defined(NOMINMAX)
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Read only memory mapped file
+
+class MappedFile
+{
+public:
+
+  MappedFile() :
+#if defined(_WIN32)
+    mFile(INVALID_HANDLE_VALUE),
+    mMapping(NULL),
+#endif
+    mData(NULL),
+    mSize(0)
+  {}
+
+  ~MappedFile()
+  {
+    Close();
+  }
+
+  bool Open(const std::string &aFilename)
+  {
+    Close();
+
+#if defined(_WIN32)
+    mFile = CreateFileA(aFilename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+      NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if(mFile == INVALID_HANDLE_VALUE)
+      return false;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(mFile, &size) || size.QuadPart == 0)
+    {
+      Close();
+      return false;
+    }
+
+    mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mMapping == NULL)
+    {
+      Close();
+      return false;
+    }
+
+    mData = static_cast<const char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    mSize = size_t(size.QuadPart);
+#else
+    const int fd = open(aFilename.c_str(), O_RDONLY);
+
+    if(fd < 0)
+      return false;
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+      close(fd);
+      return false;
+    }
+
+    void *data = mmap(NULL, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+
+    if(data == MAP_FAILED)
+      return false;
+
+    mData = static_cast<const char*>(data);
+    mSize = size_t(info.st_size);
+#endif
+
+    if(mData == NULL)
+    {
+      Close();
+      return false;
+    }
+
+    return true;
+  }
+
+  void Close()
+  {
+#if defined(_WIN32)
+    if(mData)
+      UnmapViewOfFile(mData);
+    if(mMapping)
+      CloseHandle(mMapping);
+    if(mFile != INVALID_HANDLE_VALUE)
+      CloseHandle(mFile);
+
+    mFile    = INVALID_HANDLE_VALUE;
+    mMapping = NULL;
+#else
+    if(mData)
+      munmap(const_cast<char*>(mData), mSize);
+#endif
+
+    mData = NULL;
+    mSize = 0;
+  }
+
+  const char* GetData() const { return mData; }
+  size_t      GetSize() const { return mSize; }
+
+private:
+
+  // Not copyable, the mapping would be released twice
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+#if defined(_WIN32)
+  HANDLE     mFile;
+  HANDLE     mMapping;
+#endif
+  const char *mData;
+  size_t     mSize;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Size and modification time of a source file, a cache made from
+// another version of the file is stale. Files that do not exist have
+// size -1.
+
+struct FileStamp
+{
+  FileStamp() : mSize(-1), mTime(0)
+  {}
+
+  bool Get(const std::string &aFilename)
+  {
+    struct stat info;
+
+    mSize = -1;
+    mTime = 0;
+
+    if(stat(aFilename.c_str(), &info) != 0)
+      return false;
+
+    mSize = (long long)info.st_size;
+    mTime = (long long)info.st_mtime;
+    return true;
+  }
+
+  long long mSize;
+  long long mTime;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Binary scene cache
+//
+// Everything Scene::LoadMesh derives from a mesh file: the material
+// slots, the area lights and the TriangleMesh arrays including its BVH
+// nodes, with triangles already in leaf order. Later runs map the file
+// and the mesh uses the arrays in place, so nothing is parsed, copied or
+// built.
+//
+// File layout, native endianness and struct layout, arrays 16B aligned:
+//   Header, CacheLibrary[], char library names[], CacheMaterial[],
+//   CacheLight[], Vec3f vertices[], uint indices[3 * triangles],
+//   int material IDs[], BVHNode[].
+// The header records the struct sizes, a cache from a build with a
+// different layout is ignored and rewritten. The materials come from
+// MTL libraries, their stamps are stored too and a changed (or newly
+// created) library makes the cache stale as the mesh file does.
+
+// Stamp of one MTL library, its name is mNameLength characters at
+// mNameOffset of the names array
+struct CacheLibrary
+{
+  long long mSize;
+  long long mTime;
+  int       mNameOffset;
+  int       mNameLength;
+};
+
+// One material slot, i.e. one material ID of the scene. Emitting
+// triangles get a slot each, slots sharing mBase share one Material.
+struct CacheMaterial
+{
+  Vec3f mDiffuse;
+  Vec3f mGlossy;
+  float mExponent;
+  int   mMirror;
+  int   mBase;    //!< First slot of the same material
+};
+
+// AreaLight of one emitting triangle, mMatID is its material slot
+struct CacheLight
+{
+  Vec3f mP0, mP1, mP2;
+  Vec3f mRadiance;
+  int   mMatID;
+};
+
+class SceneCache
+{
+public:
+
+  enum { kVersion = 1 };
+
+  SceneCache() : mHeader(NULL)
+  {}
+
+  // Maps aFilename, fails when it is missing, made from a different
+  // source file, by a build with a different layout or corrupt
+  bool Map(
+    const std::string &aFilename,
+    const FileStamp   &aSource)
+  {
+    mHeader = NULL;
+
+    if(!mFile.Open(aFilename))
+      return false;
+
+    if(mFile.GetSize() < sizeof(Header))
+      return false;
+
+    const Header &header = *reinterpret_cast<const Header*>(mFile.GetData());
+    Header expected;
+    setupHeader(expected, aSource, 0, 0, 0, 0, 0, 0, 0);
+
+    if(memcmp(header.mMagic, expected.mMagic, 4) != 0 ||
+      header.mVersion       != expected.mVersion ||
+      header.mLayout        != expected.mLayout ||
+      header.mSourceSize    != aSource.mSize ||
+      header.mSourceTime    != aSource.mTime)
+      return false;
+
+    setupHeader(expected, aSource, header.mNumLibraries, header.mNamesLength,
+      header.mNumMaterials, header.mNumLights,
+      header.mNumVertices, header.mNumTriangles, header.mNumNodes);
+
+    if(memcmp(&header, &expected, sizeof(Header)) != 0 ||
+      expected.mEnd > (long long)mFile.GetSize())
+      return false;
+
+    mHeader = &header;
+
+    if(!validate() || !librariesUpToDate())
+    {
+      mHeader = NULL;
+      return false;
+    }
+
+    return true;
+  }
+
+  int GetMaterialCount() const { return mHeader->mNumMaterials; }
+  int GetLightCount()    const { return mHeader->mNumLights; }
+
+  const CacheMaterial* GetMaterials() const
+  {
+    return getArray<CacheMaterial>(mHeader->mMaterialsOffset);
+  }
+
+  const CacheLight* GetLights() const
+  {
+    return getArray<CacheLight>(mHeader->mLightsOffset);
+  }
+
+  // Points aoMesh to the mapped arrays, the cache must outlive it
+  void SetupMesh(TriangleMesh &aoMesh) const
+  {
+    aoMesh.SetExternal(
+      getArray<Vec3f>(mHeader->mVerticesOffset), mHeader->mNumVertices,
+      getArray<uint>(mHeader->mIndicesOffset),
+      getArray<int>(mHeader->mMatIDsOffset), mHeader->mNumTriangles,
+      getArray<BVHNode>(mHeader->mNodesOffset), mHeader->mNumNodes);
+  }
+
+  // Writes under a temporary name first, an interrupted run never
+  // leaves a truncated cache behind
+  static bool Save(
+    const std::string                &aFilename,
+    const FileStamp                  &aSource,
+    const std::vector<std::string>   &aLibraries,
+    const std::vector<CacheMaterial> &aMaterials,
+    const std::vector<CacheLight>    &aLights,
+    const TriangleMesh               &aMesh)
+  {
+    std::vector<CacheLibrary> libraries(aLibraries.size());
+    std::string names;
+
+    for(size_t i=0; i<aLibraries.size(); i++)
+    {
+      FileStamp stamp;
+      stamp.Get(aLibraries[i]);
+
+      libraries[i].mSize       = stamp.mSize;
+      libraries[i].mTime       = stamp.mTime;
+      libraries[i].mNameOffset = (int)names.length();
+      libraries[i].mNameLength = (int)aLibraries[i].length();
+      names += aLibraries[i];
+    }
+
+    Header header;
+    setupHeader(header, aSource, (int)libraries.size(), (int)names.length(),
+      (int)aMaterials.size(), (int)aLights.size(),
+      aMesh.GetVertexCount(), aMesh.GetTriangleCount(), aMesh.GetNodeCount());
+
+    const std::string tmpName = aFilename + ".tmp";
+
+    {
+      std::ofstream file(tmpName.c_str(), std::ios::binary);
+
+      if(!file)
+        return false;
+
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+      writeArray(file, header.mLibrariesOffset, libraries.empty()  ? NULL : &libraries[0],  libraries.size());
+      writeArray(file, header.mNamesOffset,     names.data(),                                names.length());
+      writeArray(file, header.mMaterialsOffset, aMaterials.empty() ? NULL : &aMaterials[0], aMaterials.size());
+      writeArray(file, header.mLightsOffset,    aLights.empty()    ? NULL : &aLights[0],    aLights.size());
+      writeArray(file, header.mVerticesOffset,  aMesh.GetVertices(), aMesh.GetVertexCount());
+      writeArray(file, header.mIndicesOffset,   aMesh.GetIndices(),  3 * aMesh.GetTriangleCount());
+      writeArray(file, header.mMatIDsOffset,    aMesh.GetMatIDs(),   aMesh.GetTriangleCount());
+      writeArray(file, header.mNodesOffset,     aMesh.GetNodes(),    aMesh.GetNodeCount());
+
+      if(file.fail())
+      {
+        file.close();
+        std::remove(tmpName.c_str());
+        return false;
+      }
+    }
+
+    return CommitTempFile(tmpName, aFilename);
+  }
+
+private:
+
+  struct Header
+  {
+    char      mMagic[4];
+    int       mVersion;
+    int       mLayout;  //!< Sizes of the stored structs, see layoutKey
+    int       mNumLibraries;
+    int       mNamesLength;
+    int       mNumMaterials;
+    int       mNumLights;
+    int       mNumVertices;
+    int       mNumTriangles;
+    int       mNumNodes;
+    long long mSourceSize;
+    long long mSourceTime;
+    long long mLibrariesOffset;
+    long long mNamesOffset;
+    long long mMaterialsOffset;
+    long long mLightsOffset;
+    long long mVerticesOffset;
+    long long mIndicesOffset;
+    long long mMatIDsOffset;
+    long long mNodesOffset;
+    long long mEnd;
+  };
+
+  static int layoutKey()
+  {
+    return int(sizeof(Vec3f) | (sizeof(BVHNode) << 8) |
+      (sizeof(CacheMaterial) << 16) | (sizeof(CacheLight) << 24));
+  }
+
+  static long long align(long long aOffset)
+  {
+    return (aOffset + 15) & ~15LL;
+  }
+
+  // Fills the header, including all offsets, for the given counts
+  static void setupHeader(
+    Header          &oHeader,
+    const FileStamp &aSource,
+    int             aNumLibraries,
+    int             aNamesLength,
+    int             aNumMaterials,
+    int             aNumLights,
+    int             aNumVertices,
+    int             aNumTriangles,
+    int             aNumNodes)
+  {
+    memset(&oHeader, 0, sizeof(oHeader));
+    memcpy(oHeader.mMagic, "PG3S", 4);
+
+    oHeader.mVersion      = kVersion;
+    oHeader.mLayout       = layoutKey();
+    oHeader.mNumLibraries = aNumLibraries;
+    oHeader.mNamesLength  = aNamesLength;
+    oHeader.mNumMaterials = aNumMaterials;
+    oHeader.mNumLights    = aNumLights;
+    oHeader.mNumVertices  = aNumVertices;
+    oHeader.mNumTriangles = aNumTriangles;
+    oHeader.mNumNodes     = aNumNodes;
+    oHeader.mSourceSize   = aSource.mSize;
+    oHeader.mSourceTime   = aSource.mTime;
+
+    long long offset = align(sizeof(Header));
+
+    oHeader.mLibrariesOffset = offset;
+    offset = align(offset + aNumLibraries * (long long)sizeof(CacheLibrary));
+    oHeader.mNamesOffset     = offset;
+    offset = align(offset + aNamesLength);
+    oHeader.mMaterialsOffset = offset;
+    offset = align(offset + aNumMaterials * (long long)sizeof(CacheMaterial));
+    oHeader.mLightsOffset    = offset;
+    offset = align(offset + aNumLights * (long long)sizeof(CacheLight));
+    oHeader.mVerticesOffset  = offset;
+    offset = align(offset + aNumVertices * (long long)sizeof(Vec3f));
+    oHeader.mIndicesOffset   = offset;
+    offset = align(offset + 3 * aNumTriangles * (long long)sizeof(uint));
+    oHeader.mMatIDsOffset    = offset;
+    offset = align(offset + aNumTriangles * (long long)sizeof(int));
+    oHeader.mNodesOffset     = offset;
+    offset = offset + aNumNodes * (long long)sizeof(BVHNode);
+    oHeader.mEnd             = offset;
+  }
+
+  // Checks every index stored in the arrays once, so that rendering
+  // can use them without bounds checks
+  bool validate() const
+  {
+    const int numMaterials = mHeader->mNumMaterials;
+    const int numVertices  = mHeader->mNumVertices;
+    const int numTriangles = mHeader->mNumTriangles;
+    const int numNodes     = mHeader->mNumNodes;
+
+    if(numMaterials < 0 || mHeader->mNumLights < 0 || numVertices < 0 ||
+      numTriangles < 0 || numNodes < 0 || (numTriangles > 0 && numNodes == 0) ||
+      mHeader->mNumLibraries < 0 || mHeader->mNamesLength < 0)
+      return false;
+
+    const CacheLibrary *libraries = getArray<CacheLibrary>(mHeader->mLibrariesOffset);
+    for(int i=0; i<mHeader->mNumLibraries; i++)
+    {
+      if(libraries[i].mNameOffset < 0 || libraries[i].mNameLength < 0 ||
+        libraries[i].mNameOffset > mHeader->mNamesLength - libraries[i].mNameLength)
+        return false;
+    }
+
+    const CacheMaterial *materials = GetMaterials();
+    for(int i=0; i<numMaterials; i++)
+    {
+      if(materials[i].mBase < 0 || materials[i].mBase > i)
+        return false;
+    }
+
+    const CacheLight *lights = GetLights();
+    for(int i=0; i<mHeader->mNumLights; i++)
+    {
+      if(lights[i].mMatID < 0 || lights[i].mMatID >= numMaterials)
+        return false;
+    }
+
+    const uint *indices = getArray<uint>(mHeader->mIndicesOffset);
+    for(int i=0; i<3 * numTriangles; i++)
+    {
+      if(indices[i] >= uint(numVertices))
+        return false;
+    }
+
+    const int *matIDs = getArray<int>(mHeader->mMatIDsOffset);
+    for(int i=0; i<numTriangles; i++)
+    {
+      if(matIDs[i] < 0 || matIDs[i] >= numMaterials)
+        return false;
+    }
+
+    // The mesh never traverses the nodes of an empty mesh
+    if(numTriangles == 0)
+      return true;
+
+    // Children are stored after their parent, so a valid tree has no
+    // cycles, and every node has at most one parent, otherwise a later
+    // parent could hide the depth of a deeper one. Its depth bounds the
+    // traversal stack, -1 marks nodes no parent has reached (yet).
+    const BVHNode *nodes = getArray<BVHNode>(mHeader->mNodesOffset);
+    std::vector<int> depth(numNodes, -1);
+    depth[0] = 0;
+
+    for(int i=0; i<numNodes; i++)
+    {
+      const BVHNode &node = nodes[i];
+
+      // Never traversed
+      if(depth[i] < 0)
+        continue;
+
+      if(depth[i] >= BVHBuilder::kStackSize)
+        return false;
+
+      if(node.mCount > 0)
+      {
+        if(node.mOffset < 0 || node.mOffset > numTriangles - node.mCount)
+          return false;
+      }
+      else
+      {
+        if(node.mCount < 0 || node.mAxis < 0 || node.mAxis > 2 ||
+          node.mOffset <= i + 1 || node.mOffset >= numNodes)
+          return false;
+
+        if(depth[i + 1] >= 0 || depth[node.mOffset] >= 0)
+          return false;
+
+        depth[i + 1]        = depth[i] + 1;
+        depth[node.mOffset] = depth[i] + 1;
+      }
+    }
+
+    return true;
+  }
+
+  // The MTL libraries have the stamps they had when the cache was written
+  bool librariesUpToDate() const
+  {
+    const CacheLibrary *libraries = getArray<CacheLibrary>(mHeader->mLibrariesOffset);
+    const char         *names     = getArray<char>(mHeader->mNamesOffset);
+
+    for(int i=0; i<mHeader->mNumLibraries; i++)
+    {
+      FileStamp stamp;
+      stamp.Get(std::string(names + libraries[i].mNameOffset, libraries[i].mNameLength));
+
+      if(stamp.mSize != libraries[i].mSize || stamp.mTime != libraries[i].mTime)
+        return false;
+    }
+
+    return true;
+  }
+
+  // Pads the file to aOffset and writes the array there
+  template<typename T>
+  static void writeArray(
+    std::ofstream &aoFile,
+    long long     aOffset,
+    const T       *aData,
+    size_t        aCount)
+  {
+    static const char padding[16] = { 0 };
+    const long long position = (long long)aoFile.tellp();
+
+    if(aOffset > position)
+      aoFile.write(padding, std::streamsize(aOffset - position));
+
+    if(aCount > 0)
+      aoFile.write(reinterpret_cast<const char*>(aData), std::streamsize(aCount * sizeof(T)));
+  }
+
+  template<typename T>
+  const T* getArray(long long aOffset) const
+  {
+    return reinterpret_cast<const T*>(mFile.GetData() + aOffset);
+  }
+
+  MappedFile   mFile;
+  const Header *mHeader;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include "math.hxx"
+
+//////////////////////////////////////////////////////////////////////////
+// Image tile, pixels [mX0, mX1) x [mY0, mY1)
+
+struct Tile
+{
+  Tile() {}
+
+  Tile(int aX0, int aY0, int aX1, int aY1) :
+    mX0(aX0), mY0(aY0), mX1(aX1), mY1(aY1)
+  {}
+
+  int mX0, mY0;
+  int mX1, mY1;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Tile scheduler
+//
+// Every thread owns a contiguous range of tiles and takes them in order.
+// Once its range is exhausted it steals from the other threads, walking
+// them round robin. Both owner and thief take tiles with a single atomic
+// increment of the victim's counter, so there are no locks.
+
+class TileScheduler
+{
+public:
+
+  TileScheduler(
+    const Vec2i &aResolution,
+    int         aTileSize,
+    int         aNumThreads) :
+  mResolution(aResolution),
+    mTileSize(aTileSize),
+    mQueues(std::max(1, aNumThreads))
+  {
+    mTilesX = (aResolution.x + aTileSize - 1) / aTileSize;
+    mTilesY = (aResolution.y + aTileSize - 1) / aTileSize;
+    Reset();
+  }
+
+  // Makes all tiles available again, must not run concurrently with Next
+  void Reset()
+  {
+    const int numQueues = (int)mQueues.size();
+    const int numTiles  = GetTileCount();
+
+    for(int i=0; i<numQueues; i++)
+    {
+      mQueues[i].mNext.store(int(i * (long long)numTiles / numQueues));
+      mQueues[i].mEnd = int((i + 1) * (long long)numTiles / numQueues);
+    }
+  }
+
+  // Returns false once there are no tiles left for this iteration
+  bool Next(
+    int  aThreadId,
+    Tile &oTile)
+  {
+    const int numQueues = (int)mQueues.size();
+
+    for(int i=0; i<numQueues; i++)
+    {
+      Queue &queue = mQueues[(aThreadId + i) % numQueues];
+
+      // Cheap check first, so that drained queues are not incremented forever
+      if(queue.mNext.load(std::memory_order_relaxed) >= queue.mEnd)
+        continue;
+
+      const int tileIdx = queue.mNext.fetch_add(1, std::memory_order_relaxed);
+
+      if(tileIdx < queue.mEnd)
+      {
+        oTile = GetTile(tileIdx);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  int GetTileCount() const
+  {
+    return mTilesX * mTilesY;
+  }
+
+  Tile GetTile(int aTileIdx) const
+  {
+    const int x0 = (aTileIdx % mTilesX) * mTileSize;
+    const int y0 = (aTileIdx / mTilesX) * mTileSize;
+
+    return Tile(x0, y0,
+      std::min(x0 + mTileSize, mResolution.x),
+      std::min(y0 + mTileSize, mResolution.y));
+  }
+
+private:
+
+  // Padded to a cache line, so that counters of different threads
+  // do not share one
+  struct Queue
+  {
+    Queue() : mNext(0), mEnd(0) {}
+
+    std::atomic<int> mNext;
+    int              mEnd;
+    char             mPadding[64 - sizeof(std::atomic<int>) - sizeof(int)];
+  };
+
+  Vec2i              mResolution;
+  int                mTileSize;
+  int                mTilesX;
+  int                mTilesY;
+  std::vector<Queue> mQueues;
+};
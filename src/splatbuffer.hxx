@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include "math.hxx"
+#include "framebuffer.hxx"
+
+//////////////////////////////////////////////////////////////////////////
+// Splat buffer
+//
+// Full resolution radiance buffer shared by all threads. Light tracing
+// style renderers add to random pixels, so instead of every thread
+// keeping its own Framebuffer that is merged at the end, contributions
+// are added here with atomic float additions.
+
+class SplatBuffer
+{
+public:
+
+  SplatBuffer() :
+    mResolution(0.f),
+    mResX(0),
+    mResY(0)
+  {}
+
+  void Setup(const Vec2f& aResolution)
+  {
+    mResolution = aResolution;
+    mResX       = int(aResolution.x);
+    mResY       = int(aResolution.y);
+    mData.assign(3 * mResX * mResY, 0.f);
+  }
+
+  // Returns the pixel index of aSample, or -1 when outside of the image
+  int GetPixelIndex(const Vec2f& aSample) const
+  {
+    if(aSample.x < 0 || aSample.x >= mResolution.x)
+      return -1;
+
+    if(aSample.y < 0 || aSample.y >= mResolution.y)
+      return -1;
+
+    return int(aSample.x) + int(aSample.y) * mResX;
+  }
+
+  // Thread safe
+  void AtomicAdd(
+    int          aPixelIndex,
+    const Vec3f& aColor)
+  {
+    float *pixel = &mData[3 * aPixelIndex];
+
+    for(int i=0; i<3; i++)
+    {
+#pragma omp atomic
+      pixel[i] += aColor.Get(i);
+    }
+  }
+
+  // Adds the accumulated radiance times aScale to aoFramebuffer, which
+  // must have the same resolution. Must not run concurrently with AtomicAdd.
+  void Resolve(
+    Framebuffer &aoFramebuffer,
+    float       aScale) const
+  {
+    for(int y=0; y<mResY; y++)
+    {
+      for(int x=0; x<mResX; x++)
+      {
+        const float *pixel = &mData[3 * (x + y * mResX)];
+
+        aoFramebuffer.AddColor(Vec2f(float(x), float(y)),
+          Vec3f(pixel[0], pixel[1], pixel[2]) * Vec3f(aScale));
+      }
+    }
+  }
+
+  size_t GetMemorySize() const
+  {
+    return mData.size() * sizeof(float);
+  }
+
+private:
+
+  Vec2f              mResolution;
+  int                mResX, mResY;
+  std::vector<float> mData;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Splat log
+//
+// Per thread list of pending splats. Entries are only appended, once the
+// log is full it is flushed into the shared SplatBuffer. Batching keeps
+// the atomics of one thread together instead of interleaving them with
+// path tracing, and bounds the memory to kCapacity entries per thread.
+
+class SplatLog
+{
+public:
+
+  enum { kCapacity = 4096 };
+
+  explicit SplatLog(SplatBuffer &aBuffer) :
+    mBuffer(aBuffer)
+  {
+    mPixels.reserve(kCapacity);
+    mColors.reserve(kCapacity);
+  }
+
+  ~SplatLog()
+  {
+    Flush();
+  }
+
+  void Add(
+    const Vec2f& aSample,
+    const Vec3f& aColor)
+  {
+    const int pixelIndex = mBuffer.GetPixelIndex(aSample);
+
+    if(pixelIndex < 0)
+      return;
+
+    mPixels.push_back(pixelIndex);
+    mColors.push_back(aColor);
+
+    if((int)mPixels.size() >= kCapacity)
+      Flush();
+  }
+
+  void Flush()
+  {
+    for(size_t i=0; i<mPixels.size(); i++)
+      mBuffer.AtomicAdd(mPixels[i], mColors[i]);
+
+    mPixels.clear();
+    mColors.clear();
+  }
+
+  size_t GetMemorySize() const
+  {
+    return mPixels.capacity() * sizeof(int) + mColors.capacity() * sizeof(Vec3f);
+  }
+
+private:
+
+  SplatBuffer        &mBuffer;
+  std::vector<int>   mPixels;
+  std::vector<Vec3f> mColors;
+};
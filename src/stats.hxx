@@ -0,0 +1,120 @@
+#pragma once
+
+#include <vector>
+#include <cstring>
+
+//////////////////////////////////////////////////////////////////////////
+// Render statistics
+//
+// Per thread counters of rays and BRDF samples, used by the benchmark
+// suite (--bench-render). Counting is compiled in only with RAY_STATS
+// set to 1, otherwise STATS_COUNT expands to nothing and the hot paths
+// are unchanged. Busy time of the threads is always collected, it costs
+// one timer call per thread and parallel region.
+
+#if !defined(RAY_STATS)
+#   define RAY_STATS 0
+#endif
+
+#if defined(_MSC_VER) && (_MSC_VER < 1900)
+#   define STATS_THREAD_LOCAL __declspec(thread)
+#else
+#   define STATS_THREAD_LOCAL thread_local
+#endif
+
+enum StatCounter
+{
+  kStatPrimaryRays,  //!< Camera rays, Camera::GenerateRay
+  kStatClosestRays,  //!< All Scene::Intersect queries, primary included
+  kStatShadowRays,   //!< Scene::Occluded queries
+  kStatLightPaths,   //!< Paths started on a light
+  kStatBrdfSamples,  //!< Material::sampleBrdfHemisphere
+  kStatCounterMax
+};
+
+// Plain data, so the thread local instance needs no constructor call
+struct ThreadStats
+{
+  void Add(const ThreadStats &aOther)
+  {
+    for(int i=0; i<kStatCounterMax; i++)
+      mCounters[i] += aOther.mCounters[i];
+
+    mBusyTime += aOther.mBusyTime;
+  }
+
+  long long Get(StatCounter aCounter) const
+  {
+    return mCounters[aCounter];
+  }
+
+  // Closest hit rays which are not camera rays
+  long long GetIndirectRays() const
+  {
+    return mCounters[kStatClosestRays] - mCounters[kStatPrimaryRays];
+  }
+
+  long long GetTotalRays() const
+  {
+    return mCounters[kStatClosestRays] + mCounters[kStatShadowRays];
+  }
+
+  long long mCounters[kStatCounterMax];
+  double    mBusyTime; //!< Seconds spent rendering, not waiting
+};
+
+// Counters of the calling thread since they were last collected
+STATS_THREAD_LOCAL ThreadStats g_ThreadStats;
+
+#if RAY_STATS
+#   define STATS_COUNT(aCounter) (g_ThreadStats.mCounters[aCounter]++)
+#else
+#   define STATS_COUNT(aCounter) ((void)0)
+#endif
+
+// Statistics of one render, one entry per thread
+class RenderStats
+{
+public:
+
+  void Setup(int aNumThreads)
+  {
+    ThreadStats empty;
+    memset(&empty, 0, sizeof(empty));
+    mThreads.assign(aNumThreads, empty);
+  }
+
+  // Moves the counters of the calling thread into its entry, adding
+  // aBusyTime. Must be called by the thread aThreadId itself.
+  void Collect(int aThreadId, double aBusyTime)
+  {
+    g_ThreadStats.mBusyTime += aBusyTime;
+    mThreads[aThreadId].Add(g_ThreadStats);
+    memset(&g_ThreadStats, 0, sizeof(g_ThreadStats));
+  }
+
+  int GetThreadCount() const
+  {
+    return (int)mThreads.size();
+  }
+
+  const ThreadStats& GetThread(int aThreadId) const
+  {
+    return mThreads[aThreadId];
+  }
+
+  ThreadStats GetTotal() const
+  {
+    ThreadStats total;
+    memset(&total, 0, sizeof(total));
+
+    for(size_t i=0; i<mThreads.size(); i++)
+      total.Add(mThreads[i]);
+
+    return total;
+  }
+
+private:
+
+  std::vector<ThreadStats> mThreads;
+};
@@ -2,8 +2,17 @@
 
 #include <vector>
 #include <cmath>
+#include <cstdio>
+#include <string>
 #include "math.hxx"
 
+#if defined(_WIN32)
+#   if !defined(NOMINMAX)
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#endif
+
 // sRGB luminance
 float Luminance(const Vec3f& aRGB)
 {
@@ -249,4 +258,21 @@ Vec3f sampleUniformHemisphere(const Vec2f& samples, float* oPdf)
   if (oPdf)
     *oPdf = std::sin(theta) / (PI_F * PI_F / 2.0f);
   return mappedSamples;
-}
\ No newline at end of file
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Replaces aFilename by the completely written aTmpName. The replacement
+// is atomic, a crash leaves either the old or the new file, never none.
+bool CommitTempFile(
+  const std::string &aTmpName,
+  const std::string &aFilename)
+{
+#if defined(_WIN32)
+  // rename fails when the target exists, removing it first would open
+  // a window in which neither file is there
+  return MoveFileExA(aTmpName.c_str(), aFilename.c_str(),
+    MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  return std::rename(aTmpName.c_str(), aFilename.c_str()) == 0;
+#endif
+}